@@ -0,0 +1,330 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "aabb_tree.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((b) < (a) ? (a) : (b))
+
+// fraction of a box's extent added on every side of a leaf
+#define AABB_MARGIN 0.1
+
+static aabb_t aabb_union(aabb_t a, aabb_t b)
+{
+    return (aabb_t){min(a.xMin, b.xMin), max(a.xMax, b.xMax), min(a.yMin, b.yMin), max(a.yMax, b.yMax)};
+}
+
+// half the perimeter, the surface area heuristic in 2D
+static double aabb_cost(aabb_t a)
+{
+    return (a.xMax - a.xMin) + (a.yMax - a.yMin);
+}
+
+static bool aabb_contains(aabb_t outer, aabb_t inner)
+{
+    return outer.xMin <= inner.xMin && inner.xMax <= outer.xMax &&
+           outer.yMin <= inner.yMin && inner.yMax <= outer.yMax;
+}
+
+static bool aabb_overlap(aabb_t a, aabb_t b)
+{
+    return a.xMin <= b.xMax && b.xMin <= a.xMax && a.yMin <= b.yMax && b.yMin <= a.yMax;
+}
+
+static aabb_t aabb_fatten(aabb_t a)
+{
+    double dx = AABB_MARGIN * (a.xMax - a.xMin), dy = AABB_MARGIN * (a.yMax - a.yMin);
+    // a degenerate box still gets some slack from the other axis
+    double d = max(dx, dy);
+    return (aabb_t){a.xMin - d, a.xMax + d, a.yMin - d, a.yMax + d};
+}
+
+static int alloc_node(aabb_tree_t *tree)
+{
+    if (tree->free_list == -1)
+    {
+        int cap = max(16, 2 * tree->cap);
+        tree->nodes = realloc(tree->nodes, sizeof(aabb_node_t) * cap);
+        for (int i = cap - 1; i >= tree->cap; i--)
+        {
+            tree->nodes[i].parent = tree->free_list;
+            tree->nodes[i].height = -1;
+            tree->free_list = i;
+        }
+        tree->cap = cap;
+    }
+
+    int i = tree->free_list;
+    aabb_node_t *node = &tree->nodes[i];
+    tree->free_list = node->parent;
+    node->parent = node->child1 = node->child2 = -1;
+    node->height = 0;
+    return i;
+}
+
+static void free_node(aabb_tree_t *tree, int i)
+{
+    tree->nodes[i].parent = tree->free_list;
+    tree->nodes[i].height = -1;
+    tree->free_list = i;
+}
+
+// rotates node a up if its subtrees are out of balance, returns the root of
+// the subtree
+static int balance(aabb_tree_t *tree, int a)
+{
+    aabb_node_t *nodes = tree->nodes;
+    aabb_node_t *A = &nodes[a];
+    if (A->height < 2)
+        return a;
+
+    int b = A->child1, c = A->child2;
+    int d = nodes[c].height - nodes[b].height;
+    if (d >= -1 && d <= 1)
+        return a;
+
+    // the taller child takes a's place
+    int up = d > 1 ? c : b;
+    aabb_node_t *U = &nodes[up];
+    int f = U->child1, g = U->child2;
+
+    U->child1 = a;
+    U->parent = A->parent;
+    A->parent = up;
+
+    if (U->parent != -1)
+    {
+        if (nodes[U->parent].child1 == a)
+            nodes[U->parent].child1 = up;
+        else
+            nodes[U->parent].child2 = up;
+    }
+    else
+        tree->root = up;
+
+    // the taller grandchild stays under up, the other one replaces up
+    // under a
+    int keep = nodes[f].height > nodes[g].height ? f : g;
+    int move = keep == f ? g : f;
+
+    U->child2 = keep;
+    if (d > 1)
+        A->child2 = move;
+    else
+        A->child1 = move;
+    nodes[move].parent = a;
+
+    A->box = aabb_union(nodes[A->child1].box, nodes[A->child2].box);
+    U->box = aabb_union(A->box, nodes[keep].box);
+    A->height = 1 + max(nodes[A->child1].height, nodes[A->child2].height);
+    U->height = 1 + max(A->height, nodes[keep].height);
+
+    return up;
+}
+
+// refits boxes and heights from node i up to the root, rebalancing
+static void refit(aabb_tree_t *tree, int i)
+{
+    aabb_node_t *nodes = tree->nodes;
+    while (i != -1)
+    {
+        i = balance(tree, i);
+
+        aabb_node_t *n = &nodes[i];
+        n->height = 1 + max(nodes[n->child1].height, nodes[n->child2].height);
+        n->box = aabb_union(nodes[n->child1].box, nodes[n->child2].box);
+
+        i = n->parent;
+    }
+}
+
+static void insert_leaf(aabb_tree_t *tree, int leaf)
+{
+    aabb_node_t *nodes = tree->nodes;
+    if (tree->root == -1)
+    {
+        tree->root = leaf;
+        nodes[leaf].parent = -1;
+        return;
+    }
+
+    // walk down to the cheapest sibling (Box2D's branch-and-descend)
+    aabb_t box = nodes[leaf].box;
+    int i = tree->root;
+    while (nodes[i].child1 != -1)
+    {
+        aabb_node_t *n = &nodes[i];
+        double area = aabb_cost(n->box);
+        double combined = aabb_cost(aabb_union(n->box, box));
+
+        // creating a new parent here, or pushing the leaf further down
+        double cost = 2 * combined;
+        double inherited = 2 * (combined - area);
+
+        double child_cost[2];
+        int children[2] = {n->child1, n->child2};
+        for (int k = 0; k < 2; k++)
+        {
+            aabb_node_t *c = &nodes[children[k]];
+            double grown = aabb_cost(aabb_union(c->box, box));
+            child_cost[k] = (c->child1 == -1 ? grown : grown - aabb_cost(c->box)) + inherited;
+        }
+
+        if (cost < child_cost[0] && cost < child_cost[1])
+            break;
+        i = child_cost[0] < child_cost[1] ? children[0] : children[1];
+    }
+
+    int sibling = i;
+    int old_parent = nodes[sibling].parent;
+    int parent = alloc_node(tree);
+    nodes = tree->nodes;
+
+    nodes[parent].parent = old_parent;
+    nodes[parent].box = aabb_union(box, nodes[sibling].box);
+    nodes[parent].height = nodes[sibling].height + 1;
+    nodes[parent].child1 = sibling;
+    nodes[parent].child2 = leaf;
+    nodes[sibling].parent = parent;
+    nodes[leaf].parent = parent;
+
+    if (old_parent == -1)
+        tree->root = parent;
+    else if (nodes[old_parent].child1 == sibling)
+        nodes[old_parent].child1 = parent;
+    else
+        nodes[old_parent].child2 = parent;
+
+    refit(tree, nodes[leaf].parent);
+}
+
+static void remove_leaf(aabb_tree_t *tree, int leaf)
+{
+    aabb_node_t *nodes = tree->nodes;
+    if (leaf == tree->root)
+    {
+        tree->root = -1;
+        return;
+    }
+
+    int parent = nodes[leaf].parent;
+    int grand = nodes[parent].parent;
+    int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+
+    // the sibling takes the parent's place
+    nodes[sibling].parent = grand;
+    if (grand == -1)
+        tree->root = sibling;
+    else
+    {
+        if (nodes[grand].child1 == parent)
+            nodes[grand].child1 = sibling;
+        else
+            nodes[grand].child2 = sibling;
+        refit(tree, grand);
+    }
+    free_node(tree, parent);
+}
+
+int aabb_tree_insert(aabb_tree_t *tree, aabb_t box, int data)
+{
+    int leaf = alloc_node(tree);
+    tree->nodes[leaf].box = aabb_fatten(box);
+    tree->nodes[leaf].data = data;
+    insert_leaf(tree, leaf);
+    return leaf;
+}
+
+void aabb_tree_remove(aabb_tree_t *tree, int proxy)
+{
+    remove_leaf(tree, proxy);
+    free_node(tree, proxy);
+}
+
+bool aabb_tree_move(aabb_tree_t *tree, int proxy, aabb_t box)
+{
+    aabb_t fat = tree->nodes[proxy].box;
+
+    // still inside its leaf, and the leaf is not grossly oversized
+    if (aabb_contains(fat, box) && aabb_cost(fat) <= 2 * aabb_cost(aabb_fatten(box)))
+        return false;
+
+    remove_leaf(tree, proxy);
+    tree->nodes[proxy].box = aabb_fatten(box);
+    insert_leaf(tree, proxy);
+    return true;
+}
+
+void aabb_tree_free(aabb_tree_t *tree)
+{
+    free(tree->nodes);
+    *tree = (aabb_tree_t)AABB_TREE_INIT;
+}
+
+void aabb_tree_query(const aabb_tree_t *tree, aabb_t box, bool (*fn)(void *ctx, int data), void *ctx)
+{
+    if (tree->root == -1)
+        return;
+
+    // the height of a balanced tree stays far below this
+    int stack[256];
+    int top = 0;
+    stack[top++] = tree->root;
+
+    while (top > 0)
+    {
+        const aabb_node_t *n = &tree->nodes[stack[--top]];
+        if (!aabb_overlap(n->box, box))
+            continue;
+
+        if (n->child1 == -1)
+        {
+            if (!fn(ctx, n->data))
+                return;
+        }
+        else
+        {
+            stack[top++] = n->child1;
+            stack[top++] = n->child2;
+        }
+    }
+}
+
+static double aabb_distance2(aabb_t a, double x, double y)
+{
+    double dx = max(0, max(a.xMin - x, x - a.xMax));
+    double dy = max(0, max(a.yMin - y, y - a.yMax));
+    return dx * dx + dy * dy;
+}
+
+double aabb_tree_nearest(const aabb_tree_t *tree, double x, double y, double bound,
+                         double (*fn)(void *ctx, int data, double bound), void *ctx)
+{
+    if (tree->root == -1)
+        return bound;
+
+    // the nearer child is pushed last, so leaves come roughly nearest
+    // first and the bound shrinks before the far subtrees are reached;
+    // a subtree's farther child waits on the stack, so it stays shallow
+    int stack[256];
+    int top = 0;
+    stack[top++] = tree->root;
+
+    while (top > 0)
+    {
+        const aabb_node_t *n = &tree->nodes[stack[--top]];
+        if (aabb_distance2(n->box, x, y) >= bound)
+            continue;
+
+        if (n->child1 == -1)
+            bound = fn(ctx, n->data, bound);
+        else
+        {
+            double d1 = aabb_distance2(tree->nodes[n->child1].box, x, y);
+            double d2 = aabb_distance2(tree->nodes[n->child2].box, x, y);
+            stack[top++] = d1 <= d2 ? n->child2 : n->child1;
+            stack[top++] = d1 <= d2 ? n->child1 : n->child2;
+        }
+    }
+    return bound;
+}
@@ -0,0 +1,51 @@
+#ifndef AABB_TREE_H
+#define AABB_TREE_H
+
+#include <stdbool.h>
+
+typedef struct
+{
+    double xMin, xMax, yMin, yMax;
+} aabb_t;
+
+typedef struct
+{
+    aabb_t box; // fattened for leaves
+    int parent; // next free node for free nodes
+    int child1, child2; // -1 for leaves
+    int height; // 0 for leaves, -1 for free nodes
+    int data;
+} aabb_node_t;
+
+// Dynamic bounding volume hierarchy in the style of Box2D's b2DynamicTree:
+// leaves hold boxes fattened by a margin, so a box that moves a little stays
+// inside its leaf and costs nothing; inserts pick the sibling by the
+// surface-area heuristic and AVL-style rotations keep the tree balanced.
+// Proxies (leaf node indices) stay valid until removed.
+typedef struct
+{
+    aabb_node_t *nodes;
+    int cap;
+    int root;
+    int free_list;
+} aabb_tree_t;
+
+#define AABB_TREE_INIT {NULL, 0, -1, -1}
+
+int aabb_tree_insert(aabb_tree_t *tree, aabb_t box, int data);
+void aabb_tree_remove(aabb_tree_t *tree, int proxy);
+// updates the box of a proxy, returns whether it had to be reinserted
+bool aabb_tree_move(aabb_tree_t *tree, int proxy, aabb_t box);
+void aabb_tree_free(aabb_tree_t *tree);
+
+// calls fn(ctx, data) for every leaf whose fattened box overlaps box, until
+// fn returns false
+void aabb_tree_query(const aabb_tree_t *tree, aabb_t box, bool (*fn)(void *ctx, int data), void *ctx);
+// calls fn(ctx, data, bound) for leaves whose fattened box is closer to
+// (x, y) than bound (a squared distance), nearest first by a depth-first
+// descent; fn returns the new bound, and so prunes the rest. Returns the
+// last bound.
+double aabb_tree_nearest(const aabb_tree_t *tree, double x, double y, double bound,
+                         double (*fn)(void *ctx, int data, double bound), void *ctx);
+
+#endif
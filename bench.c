@@ -0,0 +1,1134 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "nifs3.h"
+#include "parallel.h"
+#include "bench_util.h"
+
+#define max(a, b) ((b) < (a) ? (a) : (b))
+
+///////////// Timing //////////////
+// keeps the compiler from dropping evaluations whose results are unused
+volatile double sink;
+
+// the curves the 2D benchmarks work on
+nifs3_pool_t curves = NIFS3_POOL_INIT;
+
+// results outside their budget or wrong; nifs3bench fails if there are any
+int failed;
+
+///////////// Interval lookup //////////////
+// the original linear scan, kept as the baseline
+double nifs3_get_linear(const nifs3_t *interp, double x)
+{
+    int i = 1;
+    while (i < interp->n && x >= interp->x[i])
+        i++;
+
+    i = i < interp->n - 1 ? i : interp->n - 1;
+
+    double h = interp->x[i] - interp->x[i - 1];
+    double t1 = interp->x[i] - x;
+    double t2 = x - interp->x[i - 1];
+
+    return (1 / h) * (interp->M[i - 1] / 6 * t1 * t1 * t1 +
+                      interp->M[i] / 6 * t2 * t2 * t2 +
+                      (interp->y[i - 1] - interp->M[i - 1] / 6 * h * h) * t1 +
+                      (interp->y[i] - interp->M[i] / 6 * h * h) * t2);
+}
+
+void bench_get(int n)
+{
+    nifs3_t *spline = random_spline(n, false);
+
+    int m = 1 << 16;
+    double *q = random_values(m);
+
+    // keep the slow path from running for minutes on large n
+    int m_linear = n > 4096 ? m / 16 : m;
+
+    double start = now();
+    double acc = 0;
+    for (int i = 0; i < m_linear; i++)
+        acc += nifs3_get_linear(spline, q[i]);
+    double linear = (now() - start) / m_linear;
+
+    start = now();
+    for (int i = 0; i < m; i++)
+        acc += nifs3_get(spline, q[i]);
+    double binary = (now() - start) / m;
+    sink = acc;
+
+    printf("nifs3_get,%d,%.1f,%.1f,%.1f\n", n, linear * 1e9, binary * 1e9, linear / binary);
+
+    nifs3_free(spline);
+    free(q);
+}
+
+void bench_sweep(int n)
+{
+    nifs3_t *spline = random_spline(n, false);
+
+    int m = 1024 * 32;
+    double *u = alloc_linspace(0, 1, m);
+    double *out = malloc(sizeof(double) * m);
+
+    double start = now();
+    for (int i = 0; i < m; i++)
+        out[i] = nifs3_get(spline, u[i]);
+    double single = (now() - start) / m;
+
+    start = now();
+    nifs3_eval_sorted(spline, u, m, out);
+    double sorted = (now() - start) / m;
+    sink = out[m / 2];
+
+    printf("nifs3_eval_sorted,%d,%.1f,%.1f,%.1f\n", n, single * 1e9, sorted * 1e9, single / sorted);
+
+    nifs3_free(spline);
+    free(out);
+    free(u);
+}
+
+void bench_coeffs(int n)
+{
+    nifs3_t *plain = random_spline(n, false);
+    nifs3_t *coeffs = nifs3_init(plain->x, plain->y, n, true);
+
+    int m = 1024 * 32;
+    double *u = alloc_linspace(0, 1, m);
+    double *out = malloc(sizeof(double) * m);
+
+    double start = now();
+    nifs3_eval_sorted(plain, u, m, out);
+    double before = (now() - start) / m;
+
+    start = now();
+    nifs3_eval_sorted(coeffs, u, m, out);
+    double after = (now() - start) / m;
+    sink = out[m / 2];
+
+    printf("nifs3_coeffs,%d,%.2f,%.2f,%.1f\n", n, before * 1e9, after * 1e9, before / after);
+
+    nifs3_free(plain);
+    nifs3_free(coeffs);
+    free(out);
+    free(u);
+}
+
+void bench_block(int n)
+{
+    nifs3_t *sx = random_spline(n, false), *sy = random_spline(n, false);
+    const double *t = sx->x, *x = sx->y, *y = sy->y;
+
+    int c = create_nifs3_2d(&curves, x, y, t, n);
+
+    int m = 1024 * 32;
+    double *u = alloc_linspace(0, 1, m);
+    double *xy = malloc(sizeof(double) * 2 * m);
+
+    double start = now();
+    eval_nifs3_2d_sorted(&curves, c, u, m, xy, xy + m);
+    double sorted = (now() - start) / m;
+
+    const char *names[] = {"scalar", "sse2", "avx2"};
+    for (nifs3_isa_t isa = NIFS3_ISA_SCALAR; isa <= NIFS3_ISA_AVX2; isa++)
+    {
+        if (nifs3_set_isa(isa) != isa)
+            break;
+
+        start = now();
+        eval_nifs3_2d_block(&curves, c, u, m, xy);
+        double block = (now() - start) / m;
+        sink = xy[m];
+
+        printf("eval_nifs3_2d_block_%s,%d,%.2f,%.2f,%.1f\n", names[isa], n,
+               sorted * 1e9, block * 1e9, sorted / block);
+    }
+    nifs3_set_isa(nifs3_isa_supported());
+
+    free_nifs3_2d(&curves, c);
+    free(xy);
+    free(u);
+    nifs3_free(sx);
+    nifs3_free(sy);
+}
+
+void bench_init_2d(int n)
+{
+    nifs3_t *sx = random_spline(n, false), *sy = random_spline(n, false);
+    const double *t = sx->x, *x = sx->y, *y = sy->y;
+
+    int reps = max(1, (1 << 20) / n);
+
+    // the two variants take turns and each counts its fastest round, so
+    // neither gets warmer caches or allocator than the other; both keep the
+    // two splines alive together, as a curve does
+    double separate = INFINITY, shared = INFINITY;
+    for (int round = 0; round < 5; round++)
+    {
+        double start = now();
+        for (int r = 0; r < reps; r++)
+        {
+            nifs3_t *iX = nifs3_init(t, x, n, true);
+            nifs3_t *iY = nifs3_init(t, y, n, true);
+            nifs3_free(iX);
+            nifs3_free(iY);
+        }
+        separate = fmin(separate, (now() - start) / reps);
+
+        start = now();
+        for (int r = 0; r < reps; r++)
+        {
+            nifs3_t *iX, *iY;
+            nifs3_init_2d(t, x, y, n, true, &iX, &iY);
+            nifs3_free(iX);
+            nifs3_free(iY);
+        }
+        shared = fmin(shared, (now() - start) / reps);
+    }
+
+    printf("nifs3_init_2d,%d,%.1f,%.1f,%.1f\n", n, separate * 1e9, shared * 1e9, separate / shared);
+
+    nifs3_free(sx);
+    nifs3_free(sy);
+}
+
+#define APPEND_MIN_KNOTS 256
+
+// grows a curve to n nodes one 'a' keypress at a time
+void bench_append(int n)
+{
+    double *x = random_values(n);
+    double *y = random_values(n);
+
+    // the previous add_node_nifs3_2d: copy the nodes and rebuild both splines
+    double start = now();
+    nifs3_t *iX = nifs3_init(NULL, NULL, 0, true);
+    nifs3_t *iY = nifs3_init(NULL, NULL, 0, true);
+    for (int k = 1; k <= n; k++)
+    {
+        double *t = alloc_linspace(0, 1, k);
+        nifs3_free(iX);
+        nifs3_free(iY);
+        nifs3_init_2d(t, x, y, k, true, &iX, &iY);
+        free(t);
+    }
+    double rebuild = (now() - start) / n;
+    nifs3_free(iX);
+    nifs3_free(iY);
+
+    start = now();
+    int c = create_nifs3_2d(&curves, NULL, NULL, NULL, 0);
+    for (int k = 0; k < n; k++)
+        add_node_nifs3_2d(&curves, c, x[k], y[k]);
+    double append = (now() - start) / n;
+    free_nifs3_2d(&curves, c);
+
+    printf("add_node_nifs3_2d,%d,%.1f,%.1f,%.1f\n", n, rebuild * 1e9, append * 1e9, rebuild / append);
+
+    // appending has to beat rebuilding once there is something to save
+    if (n >= APPEND_MIN_KNOTS && append >= rebuild)
+    {
+        printf("add_node_nifs3_2d: %d knots, slower than a rebuild\n", n);
+        failed++;
+    }
+
+    free(x);
+    free(y);
+}
+
+// add_node_nifs3_2d on a curve loaded with uneven knots has to end up
+// where rebuilding over linspace(0, 1, n + 1) does
+void check_append_loaded()
+{
+    const double t[] = {0, 5, 10}, x[] = {0, 1, 3, 4}, y[] = {2, 0, 1, 5};
+    int c = create_nifs3_2d(&curves, x, y, t, 3);
+    add_node_nifs3_2d(&curves, c, x[3], y[3]);
+
+    double *t_ref = alloc_linspace(0, 1, 4);
+    int ref = create_nifs3_2d(&curves, x, y, t_ref, 4);
+    free(t_ref);
+
+    double err = 0;
+    for (int j = 0; j <= 100; j++)
+    {
+        double u = j / 100.0;
+        err = fmax(err, fabs(nifs3_get(curves.interp[c].iX, u) - nifs3_get(curves.interp[ref].iX, u)));
+        err = fmax(err, fabs(nifs3_get(curves.interp[c].iY, u) - nifs3_get(curves.interp[ref].iY, u)));
+    }
+    if (!(err <= 1e-12))
+    {
+        printf("add_node_nifs3_2d: appending to uneven knots is off by %g\n", err);
+        failed++;
+    }
+
+    free_nifs3_2d(&curves, c);
+    free_nifs3_2d(&curves, ref);
+}
+
+// a drag has to keep up with the mouse on any curve
+#define DRAG_BUDGET_S 1e-3
+
+// one mouse motion event of a node drag: move a node and re-solve
+void bench_drag(int n)
+{
+    // the drags move x's values, so the fixture is copied out of the spline
+    nifs3_t *sx = random_spline(n, false), *sy = random_spline(n, false);
+    const double *t = sx->x, *y = sy->y;
+    double *x = malloc(sizeof(double) * n);
+    memcpy(x, sx->y, sizeof(double) * n);
+
+    int reps = 256;
+
+    double start = now();
+    for (int r = 0; r < reps; r++)
+    {
+        nifs3_t *iX, *iY;
+        x[rand() % n] = (double)rand() / RAND_MAX;
+        nifs3_init_2d(t, x, y, n, true, &iX, &iY);
+        nifs3_free(iX);
+        nifs3_free(iY);
+    }
+    double rebuild = (now() - start) / reps;
+
+    int c = create_nifs3_2d(&curves, x, y, t, n);
+    start = now();
+    for (int r = 0; r < reps; r++)
+    {
+        int k = rand() % n;
+        set_node_nifs3_2d(&curves, c, k, (double)rand() / RAND_MAX, y[k]);
+    }
+    double local = (now() - start) / reps;
+    free_nifs3_2d(&curves, c);
+
+    printf("set_node_nifs3_2d,%d,%.1f,%.1f,%.1f\n", n, rebuild * 1e9, local * 1e9, rebuild / local);
+
+    if (local > DRAG_BUDGET_S)
+    {
+        printf("set_node_nifs3_2d: %d knots, %.1f us per motion event, over the drag budget\n", n, local * 1e6);
+        failed++;
+    }
+
+    free(x);
+    nifs3_free(sx);
+    nifs3_free(sy);
+}
+
+///////////// Loading //////////////
+// the fscanf-based loader the mmap one replaced, kept as the baseline
+double *get_line_array(FILE *fh, int *count)
+{
+    int real_count = 0;
+    int capacity = 32;
+    double *arr = malloc(sizeof(double) * capacity);
+
+    while (fscanf(fh, "%lf", &arr[real_count]) > 0)
+    {
+        real_count++;
+
+        int c;
+        while (isspace(c = fgetc(fh)) && c != '\n' && c != EOF)
+        {
+        }
+
+        if (c == '\n' || c == EOF)
+            break;
+
+        ungetc(c, fh);
+
+        if (real_count >= capacity)
+        {
+            capacity *= 2;
+            arr = realloc(arr, sizeof(double) * capacity);
+        }
+    }
+
+    arr = realloc(arr, sizeof(double) * real_count);
+    *count = real_count;
+    return arr;
+}
+
+bool load_from_file_stdio(nifs3_pool_t *pool, const char *path)
+{
+    cleanup_nifs3_2d(pool);
+
+    FILE *fh = fopen(path, "r");
+    if (fh == NULL)
+    {
+        printf("Failed to open file %s\n", path);
+        return false;
+    }
+
+    while (!feof(fh))
+    {
+        int nx, ny, nt, nu;
+        double *x = get_line_array(fh, &nx);
+        double *y = get_line_array(fh, &ny);
+        double *t = get_line_array(fh, &nt);
+        double *u = get_line_array(fh, &nu);
+
+        if (nx == 0 && ny == 0 && nt == 0 && nu == 0)
+            break;
+
+        if (nx != nt || ny != nt || nt == 0 || nu == 0)
+        {
+            printf("Invalid file format (%d %d %d %d)\n", nx, ny, nt, nu);
+            return false;
+        }
+
+        int i = create_nifs3_2d(pool, x, y, t, nt);
+        set_nifs3_2d_interpolation_pts(pool, i, u, nu);
+        free(x);
+        free(y);
+        free(t);
+        free(u);
+    }
+
+    fclose(fh);
+    return true;
+}
+
+// bitwise comparison of the curves of two loads
+bool same_curves(const nifs3_pool_t *a, const nifs3_pool_t *b)
+{
+    if (a->count != b->count)
+        return false;
+
+    for (int k = 0; k < a->count; k++)
+    {
+        const nifs3_2d_t *p = &a->interp[a->live[k]], *q = &b->interp[b->live[k]];
+        int n = p->iX->n;
+        if (n != q->iX->n || p->n != q->n ||
+            memcmp(p->iX->x, q->iX->x, sizeof(double) * n) != 0 ||
+            memcmp(p->iX->y, q->iX->y, sizeof(double) * n) != 0 ||
+            memcmp(p->iY->y, q->iY->y, sizeof(double) * n) != 0 ||
+            memcmp(p->u, q->u, sizeof(double) * p->n) != 0)
+            return false;
+    }
+    return true;
+}
+
+// writes konkurs.data repeated until the file is about mb megabytes to
+// path, returns its size or 0 on failure
+size_t write_scaled_data(const char *path, int mb)
+{
+    FILE *src = fopen(NIFS3_DATA_DIR "/konkurs.data", "rb");
+    if (src == NULL)
+    {
+        printf("Failed to open konkurs.data\n");
+        return 0;
+    }
+    char chunk[1 << 16];
+    size_t len = fread(chunk, 1, sizeof(chunk), src);
+    fclose(src);
+
+    FILE *fh = fopen(path, "wb");
+    size_t total = 0;
+    for (; total < (size_t)mb << 20; total += len + 1)
+    {
+        fwrite(chunk, 1, len, fh);
+        fputc('\n', fh);
+    }
+    fclose(fh);
+    return total;
+}
+
+void bench_load(int mb)
+{
+    char path[1024];
+    temp_path("nifs3bench_scaled.data", path, sizeof(path));
+    size_t total = write_scaled_data(path, mb);
+    if (total == 0)
+        return;
+
+    nifs3_pool_t ref = NIFS3_POOL_INIT;
+    double start = now();
+    load_from_file_stdio(&ref, path);
+    double stdio = now() - start;
+
+    start = now();
+    load_from_file(&curves, path);
+    double mapped = now() - start;
+
+    if (!same_curves(&ref, &curves))
+    {
+        printf("load_from_file: results differ from the fscanf loader\n");
+        failed++;
+    }
+
+    double mbs = total / (double)(1 << 20);
+    printf("load_from_file_MBps,%d,%.1f,%.1f,%.1f\n", mb, mbs / stdio, mbs / mapped, stdio / mapped);
+
+    cleanup_nifs3_2d(&ref);
+    cleanup_nifs3_2d(&curves);
+    remove(path);
+}
+
+// one loader thread against parallel_threads() of them
+void bench_load_threads(int mb)
+{
+    char path[1024];
+    temp_path("nifs3bench_scaled.data", path, sizeof(path));
+    size_t total = write_scaled_data(path, mb);
+    if (total == 0)
+        return;
+
+    int threads = parallel_threads();
+
+    nifs3_pool_t ref = NIFS3_POOL_INIT;
+    parallel_set_threads(1);
+    double start = now();
+    load_from_file(&ref, path);
+    double single = now() - start;
+
+    parallel_set_threads(threads);
+    start = now();
+    load_from_file(&curves, path);
+    double multi = now() - start;
+
+    if (!same_curves(&ref, &curves))
+    {
+        printf("load_from_file: results differ between thread counts\n");
+        failed++;
+    }
+
+    double mbs = total / (double)(1 << 20);
+    printf("load_from_file_%dthreads_MBps,%d,%.1f,%.1f,%.1f\n", threads, mb, mbs / single, mbs / multi,
+           single / multi);
+
+    cleanup_nifs3_2d(&ref);
+    cleanup_nifs3_2d(&curves);
+    remove(path);
+}
+
+///////////// Douglas-Peucker //////////////
+// evenly spaced samples the optimizer used to run Douglas-Peucker on
+#define DP_SAMPLES (1024 * 32)
+
+// the original recursive version, kept as the baseline; it never splits a
+// closed curve, whose chord has length 0, so those inputs are not compared
+void douglas_prucker_recursive(const double *xy, int n, double epsilon, bool *keep)
+{
+    keep[0] = keep[n - 1] = true;
+
+    double dmax = -1.f;
+    int index = 0;
+
+    double dx = xy[2 * (n - 1)] - xy[0];
+    double dy = xy[2 * (n - 1) + 1] - xy[1];
+
+    double dlen = sqrt(dx * dx + dy * dy);
+    dx /= dlen;
+    dy /= dlen;
+
+    for (int i = 1; i < n - 1; i++)
+    {
+        double d = fabs((xy[2 * i] - xy[0]) * dy - (xy[2 * i + 1] - xy[1]) * dx);
+        if (d > dmax)
+        {
+            index = i;
+            dmax = d;
+        }
+    }
+
+    if (dmax > epsilon)
+    {
+        douglas_prucker_recursive(xy, index + 1, epsilon, keep);
+        douglas_prucker_recursive(xy + 2 * index, n - index, epsilon, keep + index);
+    }
+}
+
+// one run over DP_SAMPLES points, for the stack probe
+typedef struct
+{
+    const double *xy;
+    double epsilon;
+    bool *keep;
+    int *stack;
+} dp_run_t;
+
+void run_recursive(void *arg)
+{
+    dp_run_t *r = arg;
+    memset(r->keep, 0, DP_SAMPLES);
+    douglas_prucker_recursive(r->xy, DP_SAMPLES, r->epsilon, r->keep);
+}
+
+void run_iterative(void *arg)
+{
+    dp_run_t *r = arg;
+    douglas_prucker(r->xy, DP_SAMPLES, r->epsilon, r->keep, r->stack);
+}
+
+#define PROBE_STACK_SIZE (64 << 20)
+
+void *probe_main(void *arg)
+{
+    void **call = arg;
+    ((void (*)(void *))call[0])(call[1]);
+    return NULL;
+}
+
+// peak stack use of fn(arg) in bytes, thread start-up included: fn runs on
+// a thread whose stack is painted beforehand
+size_t stack_use(void (*fn)(void *), void *arg)
+{
+    unsigned char *stack;
+    if (posix_memalign((void **)&stack, 1 << 12, PROBE_STACK_SIZE) != 0)
+        return 0;
+    memset(stack, 0xa5, PROBE_STACK_SIZE);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, stack, PROBE_STACK_SIZE);
+
+    void *call[2] = {(void *)fn, arg};
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, probe_main, call) == 0)
+        pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+
+    size_t untouched = 0;
+    while (untouched < PROBE_STACK_SIZE && stack[untouched] == 0xa5)
+        untouched++;
+
+    free(stack);
+    return PROBE_STACK_SIZE - untouched;
+}
+
+typedef struct
+{
+    double recursive, iterative; // seconds per run
+    size_t recursive_stack, iterative_stack;
+    int differ; // inputs the two versions disagree on
+    int closed; // inputs whose chord has length 0, not compared
+} dp_stats_t;
+
+// adds a run of both versions over DP_SAMPLES points xy to *st
+void measure_douglas_prucker(const double *xy, double epsilon, dp_stats_t *st)
+{
+    int m = DP_SAMPLES;
+    bool *keep = malloc(m);
+    bool *ref = malloc(m);
+    int *stack = malloc(sizeof(int) * 2 * m);
+
+    dp_run_t rec = {xy, epsilon, ref, stack}, iter = {xy, epsilon, keep, stack};
+    int reps = 5;
+    for (int rep = 0; rep < reps; rep++)
+    {
+        double start = now();
+        run_recursive(&rec);
+        st->recursive += (now() - start) / reps;
+
+        start = now();
+        run_iterative(&iter);
+        st->iterative += (now() - start) / reps;
+    }
+
+    // painting the probe stacks evicts the caches, so after the timing
+    st->recursive_stack = max(st->recursive_stack, stack_use(run_recursive, &rec));
+    st->iterative_stack = max(st->iterative_stack, stack_use(run_iterative, &iter));
+    // the recursive version never splits a chord of length 0
+    if (xy[0] == xy[2 * m - 2] && xy[1] == xy[2 * m - 1])
+        st->closed++;
+    else
+        st->differ += memcmp(keep, ref, m) != 0;
+
+    free(keep);
+    free(ref);
+    free(stack);
+}
+
+void print_douglas_prucker(const char *name, double epsilon, int points, const dp_stats_t *st)
+{
+    if (st->differ != 0)
+    {
+        printf("douglas_prucker: %d inputs of %s differ from the recursive version\n", st->differ, name);
+        failed++;
+    }
+
+    printf("douglas_prucker_%s_eps%g_ms,%d,%.2f,%.2f,%.1f\n", name, epsilon, points,
+           st->recursive * 1e3, st->iterative * 1e3, st->recursive / st->iterative);
+    printf("douglas_prucker_%s_eps%g_stack_bytes,%d,%zu,%zu,%.1f\n", name, epsilon, points,
+           st->recursive_stack, st->iterative_stack, (double)st->recursive_stack / st->iterative_stack);
+}
+
+// both versions over DP_SAMPLES samples of every curve of a .data file
+void bench_douglas_prucker(const char *name, double epsilon)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", NIFS3_DATA_DIR, name);
+    if (!load_from_file(&curves, path))
+        return;
+
+    int m = DP_SAMPLES;
+    double *u = malloc(sizeof(double) * m);
+    double *xy = malloc(sizeof(double) * 2 * m);
+    dp_stats_t st = {0};
+
+    for (int k = 0; k < curves.count; k++)
+    {
+        int i = curves.live[k];
+        const nifs3_t *iX = curves.interp[i].iX;
+        linspace(iX->x[0], iX->x[iX->n - 1], m, u);
+        eval_nifs3_2d_block(&curves, i, u, m, xy);
+        measure_douglas_prucker(xy, epsilon, &st);
+    }
+
+    print_douglas_prucker(name, epsilon, curves.count * m, &st);
+
+    free(u);
+    free(xy);
+    cleanup_nifs3_2d(&curves);
+}
+
+// A square spiral growing by a constant factor per point: the farthest
+// point from nearly every chord is the one before its end, so each split
+// peels off a single point and the recursion (on the left half, which is
+// not a tail call) goes about n deep. The radius spans e^150, so that the
+// squared distances of the iterative version do not underflow.
+void bench_douglas_prucker_spiral()
+{
+    int m = DP_SAMPLES;
+    double *xy = malloc(sizeof(double) * 2 * m);
+    double rho = exp(-150.0 / m);
+
+    for (int i = 0; i < m; i++)
+    {
+        int j = m - 1 - i;
+        double r = pow(rho, i);
+        xy[2 * j] = r * cos(i * M_PI / 2);
+        xy[2 * j + 1] = r * sin(i * M_PI / 2);
+    }
+
+    dp_stats_t st = {0};
+    measure_douglas_prucker(xy, 0, &st);
+    print_douglas_prucker("spiral", 0, m, &st);
+    free(xy);
+}
+
+///////////// Optimizer sampling //////////////
+// the original optimizer: Douglas-Peucker over DP_SAMPLES evenly spaced
+// samples
+int simplify_uniform(int i, double epsilon, double **pts)
+{
+    const nifs3_t *iX = curves.interp[i].iX;
+    int m = DP_SAMPLES;
+    double *u = alloc_linspace(iX->x[0], iX->x[iX->n - 1], m);
+    double *xy = malloc(sizeof(double) * 2 * m);
+    bool *keep = malloc(m);
+    int *stack = malloc(sizeof(int) * 2 * m);
+
+    eval_nifs3_2d_block(&curves, i, u, m, xy);
+    douglas_prucker(xy, m, epsilon, keep, stack);
+
+    int n = 0;
+    for (int j = 0; j < m; j++)
+        if (keep[j])
+            u[n++] = u[j];
+
+    free(xy);
+    free(keep);
+    free(stack);
+    *pts = u;
+    return n;
+}
+
+// largest distance of the curve from the polyline through u[0..n), checked
+// at 64 points between every two of them
+double max_chord_error(int i, const double *u, int n)
+{
+    int steps = 64, m = (n - 1) * steps;
+    double *t = calloc(max(m, 1), sizeof(double));
+    double *xy = malloc(sizeof(double) * 2 * max(m, 1));
+    double *ends = malloc(sizeof(double) * 2 * max(n, 1));
+
+    for (int j = 0; j + 1 < n; j++)
+        for (int k = 0; k < steps; k++)
+            t[j * steps + k] = u[j] + (u[j + 1] - u[j]) * k / steps;
+    eval_nifs3_2d_block(&curves, i, t, m, xy);
+    eval_nifs3_2d_block(&curves, i, u, n, ends);
+
+    double worst = 0;
+    for (int j = 0; j + 1 < n; j++)
+    {
+        const double *a = &ends[2 * j], *b = &ends[2 * j + 2];
+        double dx = b[0] - a[0], dy = b[1] - a[1];
+        double len2 = dx * dx + dy * dy;
+
+        for (int k = 0; k < steps; k++)
+        {
+            const double *p = &xy[2 * (j * steps + k)];
+            double s = len2 > 0 ? ((p[0] - a[0]) * dx + (p[1] - a[1]) * dy) / len2 : 0;
+            s = s < 0 ? 0 : s > 1 ? 1 : s;
+            worst = max(worst, hypot(p[0] - a[0] - s * dx, p[1] - a[1] - s * dy));
+        }
+    }
+
+    free(t);
+    free(xy);
+    free(ends);
+    return worst;
+}
+
+// uniform sampling against adaptive sampling over every curve of a file
+void bench_simplify(const char *name, double epsilon)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", NIFS3_DATA_DIR, name);
+    if (!load_from_file(&curves, path))
+        return;
+
+    double uniform = 0, adaptive = 0;
+    double uniform_error = 0, adaptive_error = 0;
+    int uniform_points = 0, adaptive_points = 0;
+
+    for (int k = 0; k < curves.count; k++)
+    {
+        int i = curves.live[k];
+        double *u;
+
+        double start = now();
+        int n = simplify_uniform(i, epsilon, &u);
+        uniform += now() - start;
+        uniform_points += n;
+        uniform_error = max(uniform_error, max_chord_error(i, u, n));
+        free(u);
+
+        start = now();
+        n = simplify_nifs3_2d(&curves, i, epsilon, &u);
+        adaptive += now() - start;
+        adaptive_points += n;
+        adaptive_error = max(adaptive_error, max_chord_error(i, u, n));
+        free(u);
+    }
+
+    printf("simplify_%s_eps%g_ms,%d,%.3f,%.3f,%.1f\n", name, epsilon, curves.count,
+           uniform * 1e3, adaptive * 1e3, uniform / adaptive);
+    printf("simplify_%s_eps%g_points,%d,%d,%d,%.2f\n", name, epsilon, curves.count,
+           uniform_points, adaptive_points, (double)uniform_points / adaptive_points);
+    printf("simplify_%s_eps%g_max_error,%d,%.3g,%.3g,%.2f\n", name, epsilon, curves.count,
+           uniform_error, adaptive_error, uniform_error / adaptive_error);
+
+    if (adaptive_error > epsilon)
+    {
+        printf("simplify_nifs3_2d: %s is %.3g epsilon off its polyline\n", name, adaptive_error / epsilon);
+        failed++;
+    }
+
+    cleanup_nifs3_2d(&curves);
+}
+
+///////////// Tessellation //////////////
+// Evenly spaced parameters with the spacing the flatness bound needs at the
+// most curved knot interval, the baseline for tessellate_nifs3_2d
+int tessellate_uniform(int i, double tol, double **pts)
+{
+    const nifs3_t *iX = curves.interp[i].iX, *iY = curves.interp[i].iY;
+    double bound = 0;
+    for (int k = 0; k < iX->n; k++)
+        bound = max(bound, hypot(iX->M[k], iY->M[k]));
+
+    double len = iX->x[iX->n - 1] - iX->x[0];
+    int m = (int)ceil(len * sqrt(bound / (8 * tol))) + 1;
+    *pts = alloc_linspace(iX->x[0], iX->x[iX->n - 1], m);
+    return m;
+}
+
+void bench_tessellate(const char *name, double tol)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", NIFS3_DATA_DIR, name);
+    if (!load_from_file(&curves, path))
+        return;
+
+    double uniform = 0, analytic = 0;
+    double uniform_error = 0, analytic_error = 0;
+    int uniform_points = 0, analytic_points = 0;
+
+    for (int k = 0; k < curves.count; k++)
+    {
+        int i = curves.live[k];
+        double *u;
+
+        double start = now();
+        int n = tessellate_uniform(i, tol, &u);
+        double *xy = malloc(sizeof(double) * 2 * n);
+        eval_nifs3_2d_block(&curves, i, u, n, xy);
+        uniform += now() - start;
+        uniform_points += n;
+        uniform_error = max(uniform_error, max_chord_error(i, u, n));
+        free(xy);
+        free(u);
+
+        start = now();
+        n = tessellate_nifs3_2d(&curves, i, tol, &u);
+        xy = malloc(sizeof(double) * 2 * n);
+        eval_nifs3_2d_block(&curves, i, u, n, xy);
+        analytic += now() - start;
+        analytic_points += n;
+        analytic_error = max(analytic_error, max_chord_error(i, u, n));
+        free(xy);
+        free(u);
+    }
+
+    printf("tessellate_%s_tol%g_ms,%d,%.3f,%.3f,%.1f\n", name, tol, curves.count,
+           uniform * 1e3, analytic * 1e3, uniform / analytic);
+    printf("tessellate_%s_tol%g_points,%d,%d,%d,%.2f\n", name, tol, curves.count,
+           uniform_points, analytic_points, (double)uniform_points / analytic_points);
+    printf("tessellate_%s_tol%g_max_error,%d,%.3g,%.3g,%.2f\n", name, tol, curves.count,
+           uniform_error, analytic_error, uniform_error / analytic_error);
+
+    cleanup_nifs3_2d(&curves);
+}
+
+///////////// Spatial queries //////////////
+bool count_hit(void *ctx, int i)
+{
+    (void)i;
+    (*(int *)ctx)++;
+    return true;
+}
+
+// visible-set queries for 50x50 views over n small curves spread over a
+// 1000x1000 square: a scan of every bounding box against query_nifs3_2d
+void bench_query(int n)
+{
+    for (int k = 0; k < n; k++)
+    {
+        double x[4], y[4], t[4];
+        double cx = (double)rand() / RAND_MAX * 1000, cy = (double)rand() / RAND_MAX * 1000;
+        for (int j = 0; j < 4; j++)
+        {
+            x[j] = cx + (double)rand() / RAND_MAX * 10;
+            y[j] = cy + (double)rand() / RAND_MAX * 10;
+            t[j] = j / 3.0;
+        }
+        create_nifs3_2d(&curves, x, y, t, 4);
+    }
+
+    int queries = 1000;
+    double *views = malloc(sizeof(double) * 2 * queries);
+    for (int q = 0; q < 2 * queries; q++)
+        views[q] = (double)rand() / RAND_MAX * 950;
+
+    int scanned = 0;
+    double start = now();
+    for (int q = 0; q < queries; q++)
+    {
+        double x0 = views[2 * q], y0 = views[2 * q + 1];
+        for (int k = 0; k < curves.count; k++)
+        {
+            const nifs3_2d_t *c = &curves.interp[curves.live[k]];
+            if (!(c->xMax < x0 || c->xMin > x0 + 50 || c->yMax < y0 || c->yMin > y0 + 50))
+                scanned++;
+        }
+    }
+    double scan = now() - start;
+
+    int found = 0;
+    start = now();
+    for (int q = 0; q < queries; q++)
+    {
+        double x0 = views[2 * q], y0 = views[2 * q + 1];
+        query_nifs3_2d(&curves, x0, x0 + 50, y0, y0 + 50, count_hit, &found);
+    }
+    double tree = now() - start;
+
+    if (found != scanned)
+    {
+        printf("query_nifs3_2d: %d hits, the scan found %d\n", found, scanned);
+        failed++;
+    }
+
+    printf("query_nifs3_2d_curves,%d,%.1f,%.1f,%.1f\n", n, scan / queries * 1e9, tree / queries * 1e9, scan / tree);
+
+    free(views);
+    cleanup_nifs3_2d(&curves);
+}
+
+// a click has to pick within a frame, however many curves there are
+#define PICK_BUDGET_S 1e-3
+
+// exact nearest curve to random clicks within the curves' bounds, with a
+// pick radius of 1% of their size: every curve in full against
+// nearest_nifs3_2d; also the slowest click
+void bench_nearest(const char *name)
+{
+    double xMin = INFINITY, xMax = -INFINITY, yMin = INFINITY, yMax = -INFINITY;
+    for (int k = 0; k < curves.count; k++)
+    {
+        const nifs3_2d_t *c = &curves.interp[curves.live[k]];
+        xMin = fmin(xMin, c->xMin);
+        xMax = fmax(xMax, c->xMax);
+        yMin = fmin(yMin, c->yMin);
+        yMax = fmax(yMax, c->yMax);
+    }
+    double r = 0.01 * fmax(xMax - xMin, yMax - yMin);
+
+    int clicks = 200;
+    double *q = malloc(sizeof(double) * 2 * clicks);
+    for (int j = 0; j < clicks; j++)
+    {
+        q[2 * j] = xMin + (double)rand() / RAND_MAX * (xMax - xMin);
+        q[2 * j + 1] = yMin + (double)rand() / RAND_MAX * (yMax - yMin);
+    }
+
+    int *found = malloc(sizeof(int) * clicks);
+    double start = now();
+    for (int j = 0; j < clicks; j++)
+    {
+        double best = r * r, t;
+        found[j] = -1;
+        for (int k = 0; k < curves.count; k++)
+        {
+            int i = curves.live[k];
+            double d = nearest_point_nifs3_2d(&curves, i, q[2 * j], q[2 * j + 1], INFINITY, &t);
+            if (d < best)
+            {
+                best = d;
+                found[j] = i;
+            }
+        }
+    }
+    double scan = now() - start;
+
+    // each click counts its fastest of a few runs, so that the slowest
+    // click is the query's worst case and not a preemption
+    int differ = 0;
+    double indexed = 0, slowest = 0;
+    for (int j = 0; j < clicks; j++)
+    {
+        double t = INFINITY;
+        int i = -1;
+        for (int rep = 0; rep < 3; rep++)
+        {
+            start = now();
+            i = nearest_nifs3_2d(&curves, q[2 * j], q[2 * j + 1], r, NULL);
+            t = fmin(t, now() - start);
+        }
+        indexed += t;
+        slowest = fmax(slowest, t);
+        differ += i != found[j];
+    }
+
+    if (differ > 0)
+    {
+        printf("nearest_nifs3_2d: %d clicks on %s differ from the scan\n", differ, name);
+        failed++;
+    }
+    if (slowest > PICK_BUDGET_S)
+    {
+        printf("nearest_nifs3_2d: a click on %s is over the pick budget\n", name);
+        failed++;
+    }
+
+    printf("nearest_nifs3_2d_%s_us,%d,%.1f,%.1f,%.1f\n", name, curves.count,
+           scan / clicks * 1e6, indexed / clicks * 1e6, scan / indexed);
+    printf("nearest_nifs3_2d_%s_slowest_us,%d,,%.1f,\n", name, curves.count, slowest * 1e6);
+
+    free(found);
+    free(q);
+}
+
+// optimize_nifs3_2d over the curves one by one against optimize_all_nifs3_2d
+typedef struct
+{
+    nifs3_pool_t *pool;
+    double epsilon;
+} optimize_t;
+
+void run_optimize_serial(void *ctx)
+{
+    optimize_t *b = ctx;
+    for (int k = 0; k < b->pool->count; k++)
+        optimize_nifs3_2d(b->pool, b->pool->live[k], b->epsilon);
+}
+
+void run_optimize_all(void *ctx)
+{
+    optimize_t *b = ctx;
+    optimize_all_nifs3_2d(b->pool, b->epsilon);
+}
+
+// optimizing an optimized curve redoes the same work, so both variants are
+// timed by measure() on the same pool, after one warm-up run
+void bench_optimize_all(const char *name, double epsilon)
+{
+    load_from_file(&curves, name);
+    int count = curves.count;
+
+    optimize_t b = {&curves, epsilon};
+    run_optimize_all(&b);
+    double serial = measure(run_optimize_serial, &b);
+    double parallel = measure(run_optimize_all, &b);
+
+    printf("optimize_all_%dthreads_ms,%d,%.1f,%.1f,%.1f\n", parallel_threads(), count, serial * 1e3,
+           parallel * 1e3, serial / parallel);
+    cleanup_nifs3_2d(&curves);
+}
+
+int main()
+{
+    srand(1);
+
+    printf("benchmark,knots,baseline_ns,optimized_ns,speedup\n");
+    for (int n = 16; n <= 1 << 16; n *= 4)
+        bench_get(n);
+    for (int n = 16; n <= 1 << 16; n *= 4)
+        bench_sweep(n);
+    for (int n = 16; n <= 1 << 16; n *= 4)
+        bench_coeffs(n);
+    for (int n = 16; n <= 1 << 16; n *= 4)
+        bench_block(n);
+    for (int n = 16; n <= 1 << 16; n *= 4)
+        bench_init_2d(n);
+    for (int n = 16; n <= 1 << 14; n *= 4)
+        bench_append(n);
+    check_append_loaded();
+    for (int n = 16; n <= 1 << 16; n *= 4)
+        bench_drag(n);
+    for (int mb = 4; mb <= 64; mb *= 4)
+        bench_load(mb);
+    for (int mb = 4; mb <= 64; mb *= 4)
+        bench_load_threads(mb);
+    bench_optimize_all(NIFS3_DATA_DIR "/konkurs.data", 1e-3);
+
+    const char *data_files[] = {"zadanie7.data", "konkurs.data", "konkurs_opt.data"};
+    for (int f = 0; f < 3; f++)
+        for (double eps = 1; eps >= 1e-3; eps /= 10)
+            bench_douglas_prucker(data_files[f], eps);
+    bench_douglas_prucker_spiral();
+    for (int f = 0; f < 3; f++)
+        for (double eps = 1; eps >= 1e-3; eps /= 10)
+            bench_simplify(data_files[f], eps);
+    for (int f = 0; f < 3; f++)
+        for (double tol = 1; tol >= 1e-3; tol /= 10)
+            bench_tessellate(data_files[f], tol);
+    for (int n = 1000; n <= 100000; n *= 10)
+        bench_query(n);
+    for (int f = 0; f < 3; f++)
+    {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", NIFS3_DATA_DIR, data_files[f]);
+        if (load_from_file(&curves, path))
+            bench_nearest(data_files[f]);
+    }
+    nifs3_pool_t konkurs = NIFS3_POOL_INIT;
+    if (load_from_file(&konkurs, NIFS3_DATA_DIR "/konkurs.data"))
+    {
+        tile_pool(&konkurs, 30, &curves);
+        bench_nearest("konkurs.data_30x30");
+    }
+    cleanup_nifs3_2d(&konkurs);
+    cleanup_nifs3_2d(&curves);
+
+    if (failed > 0)
+        printf("%d results over budget or wrong\n", failed);
+    return failed > 0;
+}
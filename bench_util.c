@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "bench_util.h"
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double measure(void (*fn)(void *ctx), void *ctx)
+{
+    int calls = 1;
+    for (;;)
+    {
+        double start = now();
+        for (int c = 0; c < calls; c++)
+            fn(ctx);
+        if (now() - start >= MEASURE_MIN_RUN_S || calls >= 1 << 24)
+            break;
+        calls *= 2;
+    }
+
+    double best = INFINITY;
+    for (int r = 0; r < MEASURE_REPEATS; r++)
+    {
+        double start = now();
+        for (int c = 0; c < calls; c++)
+            fn(ctx);
+        best = fmin(best, (now() - start) / calls);
+    }
+    return best;
+}
+
+double *random_values(int n)
+{
+    double *v = malloc(sizeof(double) * n);
+    for (int i = 0; i < n; i++)
+        v[i] = (double)rand() / RAND_MAX;
+    return v;
+}
+
+nifs3_t *random_spline(int n, bool coeffs)
+{
+    double *t = alloc_linspace(0, 1, n);
+    double *y = random_values(n);
+    nifs3_t *spline = nifs3_init(t, y, n, coeffs);
+    free(t);
+    free(y);
+    return spline;
+}
+
+void tile_pool(const nifs3_pool_t *src, int side, nifs3_pool_t *dst)
+{
+    cleanup_nifs3_2d(dst);
+
+    double xMin = INFINITY, xMax = -INFINITY, yMin = INFINITY, yMax = -INFINITY;
+    for (int k = 0; k < src->count; k++)
+    {
+        const nifs3_2d_t *c = &src->interp[src->live[k]];
+        xMin = fmin(xMin, c->xMin);
+        xMax = fmax(xMax, c->xMax);
+        yMin = fmin(yMin, c->yMin);
+        yMax = fmax(yMax, c->yMax);
+    }
+
+    for (int a = 0; a < side; a++)
+        for (int b = 0; b < side; b++)
+            for (int k = 0; k < src->count; k++)
+            {
+                const nifs3_2d_t *c = &src->interp[src->live[k]];
+                int n = c->iX->n;
+                double *x = malloc(sizeof(double) * n);
+                double *y = malloc(sizeof(double) * n);
+                for (int j = 0; j < n; j++)
+                {
+                    x[j] = c->iX->y[j] + a * (xMax - xMin);
+                    y[j] = c->iY->y[j] + b * (yMax - yMin);
+                }
+                int i = create_nifs3_2d(dst, x, y, c->iX->x, n);
+                set_nifs3_2d_interpolation_pts(dst, i, c->u, c->n);
+                free(x);
+                free(y);
+            }
+}
+
+void temp_path(const char *name, char *path, size_t size)
+{
+    const char *dir = getenv("TMPDIR");
+    if (dir == NULL || *dir == '\0')
+        dir = "/tmp";
+    snprintf(path, size, "%s/%d-%s", dir, (int)getpid(), name);
+}
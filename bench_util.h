@@ -0,0 +1,35 @@
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <stddef.h>
+
+#include "nifs3.h"
+
+// Helpers shared by nifs3bench, nifs3perf and nifs3batch.
+
+// monotonic wall-clock time in seconds
+double now();
+
+#define MEASURE_REPEATS 5
+#define MEASURE_MIN_RUN_S 0.05
+
+// seconds per call of fn(ctx): calls are batched until a batch takes
+// MEASURE_MIN_RUN_S, and the fastest of MEASURE_REPEATS batches counts
+double measure(void (*fn)(void *ctx), void *ctx);
+
+// n values drawn uniformly from [0, 1], allocated with malloc
+double *random_values(int n);
+
+// spline through n random values at evenly spaced knots of [0, 1], the
+// fixture of the benchmarks; its x and y hold the knots and values
+nifs3_t *random_spline(int n, bool coeffs);
+
+// replaces the curves of dst by side x side copies of those of src (with
+// their interpolation points), each shifted by their bounding box's size
+void tile_pool(const nifs3_pool_t *src, int side, nifs3_pool_t *dst);
+
+// path of a scratch file ending in name in $TMPDIR (or /tmp), unique to
+// this process, so runs from any directory leave the cwd alone
+void temp_path(const char *name, char *path, size_t size);
+
+#endif
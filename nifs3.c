@@ -0,0 +1,2281 @@
+#include <stdlib.h>
+#include <memory.h>
+#include <math.h>
+#include <assert.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "nifs3.h"
+#include "parallel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NIFS3_X86
+#include <immintrin.h>
+#endif
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((b) < (a) ? (a) : (b))
+
+/////////// Linspace //////////////
+void linspace(double start, double end, int n, double *data)
+{
+    double step = (end - start) / (n - 1);
+    for (int i = 0; i < n; i++)
+        data[i] = start + i * step;
+}
+
+double *alloc_linspace(double start, double end, int n)
+{
+    double *data = malloc(sizeof(double) * n);
+    linspace(start, end, n, data);
+    return data;
+}
+
+//////////// Natural cubic spline interpolation //////////////
+// Knot-dependent part of the natural spline system
+//   lam[i] M[i - 1] + 2 M[i] + (1 - lam[i]) M[i + 1] = d[i],  i = 1..n-2
+// after forward elimination. Splines over the same knots are solved against
+// it with no further divisions. lam and ip live in the spline's
+// nifs3_elim_t, ih and iw only in the workspace of a full build.
+typedef struct
+{
+    double *lam; // h[i] / (h[i] + h[i + 1])
+    double *ip;  // 1 / pivot of row i
+    double *ih;  // 1 / h[i], with h[i] = x[i] - x[i - 1]
+    double *iw;  // 6 / (h[i] + h[i + 1])
+} nifs3_factor_t;
+
+static void nifs3_factor(const double *x, int n, nifs3_factor_t *f)
+{
+    // row 0 is the boundary M[0] = 0, so it passes q = 0 to row 1
+    f->lam[0] = 1;
+    f->ip[0] = 0;
+
+    if (n >= 2)
+        f->ih[n - 1] = 1 / (x[n - 1] - x[n - 2]);
+
+    double q = 0;
+    for (int i = 1; i <= n - 2; i++)
+    {
+        double h_i = x[i] - x[i - 1];
+        double h_i1 = x[i + 1] - x[i];
+
+        f->ih[i] = 1 / h_i;
+        f->iw[i] = 6 / (h_i + h_i1);
+        f->lam[i] = h_i / (h_i + h_i1);
+
+        f->ip[i] = 1 / (f->lam[i] * q + 2);
+        q = (f->lam[i] - 1) * f->ip[i];
+    }
+}
+
+// eliminated right-hand side z and second derivatives M[0..n-1] of the
+// natural spline through y
+static void nifs3_solve(const nifs3_factor_t *f, const double *y, int n, double *z, double *M)
+{
+    for (int i = 0; i < n; i++)
+        z[i] = M[i] = 0;
+
+    if (n <= 2)
+        return;
+
+    for (int i = 1; i <= n - 2; i++)
+    {
+        double d = ((y[i + 1] - y[i]) * f->ih[i + 1] - (y[i] - y[i - 1]) * f->ih[i]) * f->iw[i];
+        z[i] = (d - f->lam[i] * z[i - 1]) * f->ip[i];
+    }
+
+    for (int i = n - 2; i > 0; i--)
+        M[i] = z[i] + (f->lam[i] - 1) * f->ip[i] * M[i + 1];
+}
+
+// nifs3_solve for two right-hand sides at once: both substitutions are
+// latency-bound recurrences, so interleaving them is almost free
+static void nifs3_solve_2d(const nifs3_factor_t *f, const double *x, const double *y, int n,
+                           nifs3_t *iX, nifs3_t *iY)
+{
+    double *zX = iX->z, *zY = iY->z;
+    double *MX = iX->M, *MY = iY->M;
+
+    for (int i = 0; i < n; i++)
+        zX[i] = zY[i] = MX[i] = MY[i] = 0;
+
+    if (n <= 2)
+        return;
+
+    for (int i = 1; i <= n - 2; i++)
+    {
+        double dx = ((x[i + 1] - x[i]) * f->ih[i + 1] - (x[i] - x[i - 1]) * f->ih[i]) * f->iw[i];
+        double dy = ((y[i + 1] - y[i]) * f->ih[i + 1] - (y[i] - y[i - 1]) * f->ih[i]) * f->iw[i];
+        zX[i] = (dx - f->lam[i] * zX[i - 1]) * f->ip[i];
+        zY[i] = (dy - f->lam[i] * zY[i - 1]) * f->ip[i];
+    }
+
+    for (int i = n - 2; i > 0; i--)
+    {
+        double q = (f->lam[i] - 1) * f->ip[i];
+        MX[i] = zX[i] + q * MX[i + 1];
+        MY[i] = zY[i] + q * MY[i + 1];
+    }
+}
+
+// forward elimination of the rows [from, to] from the stored knots and
+// values, refactoring them too when the knots changed
+static void nifs3_eliminate(nifs3_t *interp, int from, int to, bool refactor)
+{
+    const double *x = interp->x;
+    const double *y = interp->y;
+
+    for (int i = from; i <= to; i++)
+    {
+        double h_i = x[i] - x[i - 1];
+        double h_i1 = x[i + 1] - x[i];
+
+        if (refactor)
+        {
+            double q = (interp->elim->lam[i - 1] - 1) * interp->elim->ip[i - 1];
+            interp->elim->lam[i] = h_i / (h_i + h_i1);
+            interp->elim->ip[i] = 1 / (interp->elim->lam[i] * q + 2);
+        }
+
+        double d = ((y[i + 1] - y[i]) / h_i1 - (y[i] - y[i - 1]) / h_i) * 6 / (h_i + h_i1);
+        interp->z[i] = (d - interp->elim->lam[i] * interp->z[i - 1]) * interp->elim->ip[i];
+    }
+}
+
+// back substitution of the rows [1, from]. Rows below `settled` kept their
+// eliminated right-hand side, so once one of them comes out unchanged so do
+// all the rows under it. Returns the lowest row that was rewritten.
+static int nifs3_back_substitute(nifs3_t *interp, int from, int settled)
+{
+    double *M = interp->M;
+
+    for (int i = from; i > 0; i--)
+    {
+        double m = interp->z[i] + (interp->elim->lam[i] - 1) * interp->elim->ip[i] * M[i + 1];
+        if (i < settled && m == M[i])
+            return i + 1;
+        M[i] = m;
+    }
+
+    return 1;
+}
+
+// power-basis coefficients of the intervals [from, to]: on [x[i - 1], x[i]]
+// S(x) = a + b s + c s^2 + d s^3 with s = x - x[i - 1]; ih optionally holds
+// the reciprocal interval lengths
+static void nifs3_update_coeffs(nifs3_t *interp, const double *ih, int from, int to)
+{
+    const double *x = interp->x;
+    const double *y = interp->y;
+    const double *M = interp->M;
+
+    for (int i = from; i <= to; i++)
+    {
+        double h = x[i] - x[i - 1];
+        double r = ih != NULL ? ih[i] : 1 / h;
+        double *c = &interp->c[4 * (i - 1)];
+
+        c[0] = y[i - 1];
+        c[1] = (y[i] - y[i - 1]) * r - h * (2 * M[i - 1] + M[i]) * (1.0 / 6);
+        c[2] = M[i - 1] * 0.5;
+        c[3] = (M[i] - M[i - 1]) * r * (1.0 / 6);
+    }
+}
+
+// lam and ip in one block; the splines sharing elim see it move, as they
+// only reach it through elim
+static void nifs3_elim_reserve(nifs3_elim_t *elim, int cap, int n)
+{
+    if (cap <= elim->cap)
+        return;
+
+    double *block = malloc(sizeof(double) * 2 * cap);
+    if (elim->lam != NULL)
+    {
+        memcpy(block, elim->lam, sizeof(double) * n);
+        memcpy(block + cap, elim->ip, sizeof(double) * n);
+    }
+    free(elim->lam);
+    elim->lam = block;
+    elim->ip = block + cap;
+    elim->cap = cap;
+}
+
+// x, y, M, z and (with coeffs) c of a spline in one block, x first
+static void nifs3_grow(nifs3_t *interp, int cap, bool coeffs)
+{
+    nifs3_elim_reserve(interp->elim, cap, interp->n);
+    if (cap <= interp->cap)
+        return;
+
+    int n = interp->n;
+    double *block = malloc(sizeof(double) * (coeffs ? 8 : 4) * cap);
+    double *c = coeffs ? block + 4 * cap : NULL;
+    if (interp->x != NULL)
+    {
+        memcpy(block, interp->x, sizeof(double) * n);
+        memcpy(block + cap, interp->y, sizeof(double) * n);
+        memcpy(block + 2 * cap, interp->M, sizeof(double) * n);
+        memcpy(block + 3 * cap, interp->z, sizeof(double) * n);
+        if (c != NULL && n >= 2)
+            memcpy(c, interp->c, sizeof(double) * 4 * (n - 1));
+    }
+
+    free(interp->x);
+    interp->x = block;
+    interp->y = block + cap;
+    interp->M = block + 2 * cap;
+    interp->z = block + 3 * cap;
+    interp->c = c;
+    interp->cap = cap;
+}
+
+void nifs3_reserve(nifs3_t *interp, int cap)
+{
+    nifs3_grow(interp, cap, interp->c != NULL);
+}
+
+// a spline with room for n knots, sharing elim if it is not NULL
+static nifs3_t *nifs3_alloc(const double *x, const double *y, int n, bool coeffs, nifs3_elim_t *elim)
+{
+    nifs3_t *interp = calloc(1, sizeof(nifs3_t));
+    if (elim == NULL)
+        elim = calloc(1, sizeof(nifs3_elim_t));
+    elim->refs++;
+    interp->elim = elim;
+
+    nifs3_grow(interp, max(n, 1), coeffs);
+    interp->n = n;
+
+    if (n != 0)
+    {
+        memcpy(interp->x, x, sizeof(double) * n);
+        memcpy(interp->y, y, sizeof(double) * n);
+    }
+
+    return interp;
+}
+
+nifs3_t *nifs3_init(const double *x, const double *y, int n, bool coeffs)
+{
+    assert(n >= 0);
+    nifs3_t *interp = nifs3_alloc(x, y, n, coeffs, NULL);
+
+    double *work = malloc(sizeof(double) * 2 * max(n, 1));
+    nifs3_factor_t f = {interp->elim->lam, interp->elim->ip, work, work + max(n, 1)};
+    nifs3_factor(x, n, &f);
+    nifs3_solve(&f, y, n, interp->z, interp->M);
+
+    if (coeffs)
+        nifs3_update_coeffs(interp, f.ih, 1, n - 1);
+    free(work);
+
+    return interp;
+}
+
+void nifs3_init_2d(const double *t, const double *x, const double *y, int n, bool coeffs,
+                   nifs3_t **iX, nifs3_t **iY)
+{
+    assert(n >= 0);
+    *iX = nifs3_alloc(t, x, n, coeffs, NULL);
+    *iY = nifs3_alloc(t, y, n, coeffs, (*iX)->elim);
+
+    double *work = malloc(sizeof(double) * 2 * max(n, 1));
+    nifs3_factor_t f = {(*iX)->elim->lam, (*iX)->elim->ip, work, work + max(n, 1)};
+    nifs3_factor(t, n, &f);
+    nifs3_solve_2d(&f, x, y, n, *iX, *iY);
+
+    if (coeffs)
+    {
+        nifs3_update_coeffs(*iX, f.ih, 1, n - 1);
+        nifs3_update_coeffs(*iY, f.ih, 1, n - 1);
+    }
+    free(work);
+}
+
+nifs3_t *nifs3_copy(const nifs3_t *interp)
+{
+    int n = interp->n;
+    nifs3_t *copy = nifs3_alloc(interp->x, interp->y, n, interp->c != NULL, NULL);
+
+    memcpy(copy->M, interp->M, sizeof(double) * n);
+    memcpy(copy->elim->lam, interp->elim->lam, sizeof(double) * n);
+    memcpy(copy->elim->ip, interp->elim->ip, sizeof(double) * n);
+    memcpy(copy->z, interp->z, sizeof(double) * n);
+    if (interp->c != NULL && n >= 2)
+        memcpy(copy->c, interp->c, sizeof(double) * 4 * (n - 1));
+
+    return copy;
+}
+
+int nifs3_append(nifs3_t *interp, double x, double y)
+{
+    // NaN fails this too
+    if (interp->n > 0 && !(x > interp->x[interp->n - 1]))
+        return -1;
+
+    if (interp->n == interp->cap)
+        nifs3_reserve(interp, 2 * interp->cap);
+
+    int n = ++interp->n;
+    interp->x[n - 1] = x;
+    interp->y[n - 1] = y;
+    interp->z[n - 1] = interp->M[n - 1] = 0;
+
+    if (n == 1)
+    {
+        interp->elim->lam[0] = 1;
+        interp->elim->ip[0] = 0;
+        return 1;
+    }
+
+    // only the new row has to be eliminated; the back substitution then
+    // stops wherever the old solution is reproduced
+    int low = 1;
+    if (n >= 3)
+    {
+        nifs3_eliminate(interp, n - 2, n - 2, true);
+        low = nifs3_back_substitute(interp, n - 2, n - 2);
+    }
+
+    if (interp->c != NULL)
+        nifs3_update_coeffs(interp, NULL, low, n - 1);
+    return low;
+}
+
+int nifs3_set_value(nifs3_t *interp, int k, double y, int *last)
+{
+    if (k < 0 || k >= interp->n)
+        return -1;
+    interp->y[k] = y;
+
+    int n = interp->n;
+    int from = max(1, k - 1), hi = from - 1;
+
+    // rows k - 1..k + 1 see the new value directly; past them the change of
+    // the eliminated right-hand side decays geometrically until it rounds
+    // away, and from there on nothing differs
+    for (int i = from; i <= n - 2; i++)
+    {
+        double old = interp->z[i];
+        nifs3_eliminate(interp, i, i, false);
+        hi = i;
+        if (i > k + 1 && interp->z[i] == old)
+            break;
+    }
+
+    int low = hi >= from ? nifs3_back_substitute(interp, hi, from) : k;
+
+    // the cubics of the intervals touching a changed knot value or M
+    int first = max(1, min(low, k)), to = min(n - 1, max(hi + 1, k + 1));
+    if (interp->c != NULL && n >= 2)
+        nifs3_update_coeffs(interp, NULL, first, to);
+
+    *last = to;
+    return first;
+}
+
+void nifs3_scale_knots(nifs3_t *interp, double a)
+{
+    // lam and the pivots only depend on ratios of interval lengths, while
+    // the right-hand side and the second derivatives scale with 1 / a^2
+    double a2 = 1 / (a * a);
+    for (int i = 0; i < interp->n; i++)
+    {
+        interp->x[i] *= a;
+        interp->z[i] *= a2;
+        interp->M[i] *= a2;
+    }
+
+    if (interp->c == NULL)
+        return;
+
+    for (int i = 0; i < interp->n - 1; i++)
+    {
+        interp->c[4 * i + 1] /= a;
+        interp->c[4 * i + 2] *= a2;
+        interp->c[4 * i + 3] *= a2 / a;
+    }
+}
+
+void nifs3_free(nifs3_t *interp)
+{
+    if (interp == NULL)
+        return;
+    free(interp->x); // the block of all the spline's arrays
+    if (--interp->elim->refs == 0)
+    {
+        free(interp->elim->lam);
+        free(interp->elim);
+    }
+    free(interp);
+}
+
+int nifs3_find_interval(const nifs3_t *interp, double x)
+{
+    // branchless lower bound over x[1..n-1]: the answer is always in
+    // [base, base + len], so the loop only narrows the window
+    const double *base = interp->x + 1;
+    int len = interp->n - 1;
+
+    while (len > 1)
+    {
+        int half = len / 2;
+        base += (base[half - 1] <= x) * half;
+        len -= half;
+    }
+
+    int i = (base - interp->x) + (*base <= x);
+    return min(i, interp->n - 1);
+}
+
+static bool nifs3_in_range(const nifs3_t *interp, double x)
+{
+    if (x < interp->x[0] || x > interp->x[interp->n - 1] * 1.0001)
+    {
+        printf("x out of range (%g)\n", x);
+        return false;
+    }
+    return true;
+}
+
+// value of the cubic on [x[i - 1], x[i]] at x
+static inline double nifs3_eval_interval(const nifs3_t *interp, int i, double x)
+{
+    if (interp->c != NULL)
+    {
+        const double *c = &interp->c[4 * (i - 1)];
+        double s = x - interp->x[i - 1];
+        return c[0] + s * (c[1] + s * (c[2] + s * c[3]));
+    }
+
+    double h = interp->x[i] - interp->x[i - 1];
+    double t1 = interp->x[i] - x;
+    double t2 = x - interp->x[i - 1];
+
+    return (1 / h) * (interp->M[i - 1] / 6 * t1 * t1 * t1 +
+                      interp->M[i] / 6 * t2 * t2 * t2 +
+                      (interp->y[i - 1] - interp->M[i - 1] / 6 * h * h) * t1 +
+                      (interp->y[i] - interp->M[i] / 6 * h * h) * t2);
+}
+
+// moves the interval cursor i forward to the interval containing x >= x[i - 1]
+static inline int nifs3_advance(const nifs3_t *interp, int i, double x)
+{
+    while (i < interp->n - 1 && x >= interp->x[i])
+        i++;
+    return i;
+}
+
+double nifs3_get(const nifs3_t *interp, double x)
+{
+    if (interp->n == 0)
+        return 0;
+
+    if (!nifs3_in_range(interp, x))
+        return 0;
+
+    if (interp->n == 1)
+        return interp->y[0];
+
+    return nifs3_eval_interval(interp, nifs3_find_interval(interp, x), x);
+}
+
+void nifs3_eval_sorted(const nifs3_t *interp, const double *u, int m, double *out)
+{
+    if (interp->n <= 1 || m == 0)
+    {
+        for (int j = 0; j < m; j++)
+            out[j] = nifs3_get(interp, u[j]);
+        return;
+    }
+
+    int i = nifs3_find_interval(interp, u[0]);
+    for (int j = 0; j < m; j++)
+    {
+        if (!nifs3_in_range(interp, u[j]))
+        {
+            out[j] = 0;
+            continue;
+        }
+
+        i = nifs3_advance(interp, i, u[j]);
+        out[j] = nifs3_eval_interval(interp, i, u[j]);
+    }
+}
+
+// power-basis coefficients of the cubic on knot interval k in s = x - x[k - 1]
+static void nifs3_interval_coeffs(const nifs3_t *interp, int k, double c[4])
+{
+    const double *x = interp->x, *y = interp->y, *M = interp->M;
+    double h = x[k] - x[k - 1];
+
+    if (interp->c != NULL)
+        memcpy(c, &interp->c[4 * (k - 1)], sizeof(double) * 4);
+    else
+    {
+        c[0] = y[k - 1];
+        c[1] = (y[k] - y[k - 1]) / h - h * (2 * M[k - 1] + M[k]) * (1.0 / 6);
+        c[2] = M[k - 1] * 0.5;
+        c[3] = (M[k] - M[k - 1]) / h * (1.0 / 6);
+    }
+}
+
+void nifs3_interval_range(const nifs3_t *interp, int k, double *lo, double *hi)
+{
+    const double *x = interp->x, *y = interp->y;
+    double h = x[k] - x[k - 1];
+
+    double c[4];
+    nifs3_interval_coeffs(interp, k, c);
+
+    *lo = min(y[k - 1], y[k]);
+    *hi = max(y[k - 1], y[k]);
+
+    // stationary points: roots of S'(s) = b + 2c s + 3d s^2 inside (0, h),
+    // from the cancellation-free form of the quadratic formula
+    double A = 3 * c[3], B = 2 * c[2], C = c[1];
+    double roots[2];
+    int count = 0;
+
+    if (A == 0)
+    {
+        if (B != 0)
+            roots[count++] = -C / B;
+    }
+    else
+    {
+        double disc = B * B - 4 * A * C;
+        if (disc >= 0)
+        {
+            double q = -0.5 * (B + copysign(sqrt(disc), B));
+            roots[count++] = q / A;
+            if (q != 0)
+                roots[count++] = C / q;
+        }
+    }
+
+    for (int j = 0; j < count; j++)
+    {
+        double r = roots[j];
+        if (r > 0 && r < h)
+        {
+            double v = c[0] + r * (c[1] + r * (c[2] + r * c[3]));
+            *lo = min(*lo, v);
+            *hi = max(*hi, v);
+        }
+    }
+}
+
+void nifs3_range(const nifs3_t *interp, double *lo, double *hi)
+{
+    *lo = INFINITY;
+    *hi = -INFINITY;
+
+    if (interp->n == 1)
+        *lo = *hi = interp->y[0];
+
+    for (int k = 1; k < interp->n; k++)
+    {
+        double l, h;
+        nifs3_interval_range(interp, k, &l, &h);
+        *lo = min(*lo, l);
+        *hi = max(*hi, h);
+    }
+}
+
+///////////// 2D Interpolation //////////////
+// marks interpolator i as changed
+static void touch_nifs3_2d(nifs3_pool_t *pool, int i)
+{
+    pool->interp[i].version = ++pool->last_version;
+}
+
+static aabb_t aabb_union(aabb_t a, aabb_t b)
+{
+    return (aabb_t){min(a.xMin, b.xMin), max(a.xMax, b.xMax), min(a.yMin, b.yMin), max(a.yMax, b.yMax)};
+}
+
+// refits the bounding box of interpolator i after the cubics of its knot
+// intervals [from, to] changed, and its leaf in pool->tree with it
+static void fit_nifs3_2d(nifs3_pool_t *pool, int i, int from, int to)
+{
+    nifs3_2d_t *c = &pool->interp[i];
+    int n = c->iX->n, m = n - 1;
+    const aabb_t empty = {INFINITY, -INFINITY, INFINITY, -INFINITY};
+
+    if (m > c->bounds_leaves)
+    {
+        int leaves = max(1, c->bounds_leaves);
+        while (leaves < m)
+            leaves *= 2;
+
+        c->bounds = realloc(c->bounds, sizeof(aabb_t) * 2 * leaves);
+        for (int j = 0; j < 2 * leaves; j++)
+            c->bounds[j] = empty;
+        c->bounds_leaves = leaves;
+        from = 1;
+        to = m;
+    }
+
+    aabb_t box = empty;
+    if (n == 1)
+        box = (aabb_t){c->iX->y[0], c->iX->y[0], c->iY->y[0], c->iY->y[0]};
+    else if (n >= 2)
+    {
+        aabb_t *b = c->bounds;
+        int leaves = c->bounds_leaves;
+        from = max(from, 1);
+        to = min(to, m);
+
+        for (int k = from; k <= to; k++)
+        {
+            aabb_t *leaf = &b[leaves + k - 1];
+            nifs3_interval_range(c->iX, k, &leaf->xMin, &leaf->xMax);
+            nifs3_interval_range(c->iY, k, &leaf->yMin, &leaf->yMax);
+        }
+
+        if (from <= to)
+            for (int lo = (leaves + from - 1) / 2, hi = (leaves + to - 1) / 2; lo >= 1; lo /= 2, hi /= 2)
+                for (int j = lo; j <= hi; j++)
+                    b[j] = aabb_union(b[2 * j], b[2 * j + 1]);
+        box = b[1];
+    }
+
+    c->xMin = box.xMin;
+    c->xMax = box.xMax;
+    c->yMin = box.yMin;
+    c->yMax = box.yMax;
+    bool is_empty = !(box.xMin <= box.xMax);
+
+    if (is_empty && c->proxy != -1)
+    {
+        aabb_tree_remove(&pool->tree, c->proxy);
+        c->proxy = -1;
+    }
+    else if (!is_empty && c->proxy == -1)
+        c->proxy = aabb_tree_insert(&pool->tree, box, i);
+    else if (!is_empty)
+        aabb_tree_move(&pool->tree, c->proxy, box);
+
+    touch_nifs3_2d(pool, i);
+}
+
+typedef struct
+{
+    const nifs3_pool_t *pool;
+    aabb_t box;
+    bool (*fn)(void *ctx, int i);
+    void *ctx;
+} query_t;
+
+// the tree reports fattened boxes, the exact ones decide
+static bool query_hit(void *ctx, int i)
+{
+    query_t *q = ctx;
+    const nifs3_2d_t *c = &q->pool->interp[i];
+    if (c->xMax < q->box.xMin || c->xMin > q->box.xMax || c->yMax < q->box.yMin || c->yMin > q->box.yMax)
+        return true;
+    return q->fn(q->ctx, i);
+}
+
+void query_nifs3_2d(const nifs3_pool_t *pool, double xMin, double xMax, double yMin, double yMax, bool (*fn)(void *ctx, int i), void *ctx)
+{
+    query_t q = {pool, {xMin, xMax, yMin, yMax}, fn, ctx};
+    aabb_tree_query(&pool->tree, q.box, query_hit, &q);
+}
+
+///////////// Nearest point //////////////
+// degree of the derivative of the squared distance to a cubic
+#define NEAREST_DEGREE 5
+
+static double poly_eval(const double *p, int deg, double s)
+{
+    double v = p[deg];
+    for (int j = deg - 1; j >= 0; j--)
+        v = v * s + p[j];
+    return v;
+}
+
+// roots of p (degree deg) inside (lo, hi), ascending: p is monotone between
+// consecutive roots of p', so each of those brackets holds at most one
+// root, found by bisection down to the last bit
+static int poly_roots(const double *p, int deg, double lo, double hi, double *roots)
+{
+    while (deg > 0 && p[deg] == 0)
+        deg--;
+    if (deg == 0)
+        return 0;
+
+    if (deg == 1)
+    {
+        double r = -p[0] / p[1];
+        roots[0] = r;
+        return r > lo && r < hi;
+    }
+
+    double dp[NEAREST_DEGREE] = {0};
+    for (int j = 1; j <= deg; j++)
+        dp[j - 1] = j * p[j];
+
+    double ends[NEAREST_DEGREE + 1];
+    int m = poly_roots(dp, deg - 1, lo, hi, ends + 1);
+    ends[0] = lo;
+    ends[m + 1] = hi;
+
+    int count = 0;
+    double fa = poly_eval(p, deg, lo);
+    for (int j = 0; j <= m; j++)
+    {
+        double a = ends[j], b = ends[j + 1];
+        double fb = poly_eval(p, deg, b);
+
+        if (fb == 0 && j < m)
+            roots[count++] = b;
+        else if ((fa < 0 && fb > 0) || (fa > 0 && fb < 0))
+        {
+            bool rising = fb > 0;
+            for (;;)
+            {
+                double mid = 0.5 * (a + b);
+                if (mid <= a || mid >= b)
+                    break;
+                if ((poly_eval(p, deg, mid) > 0) == rising)
+                    b = mid;
+                else
+                    a = mid;
+            }
+            roots[count++] = 0.5 * (a + b);
+        }
+        fa = fb;
+    }
+    return count;
+}
+
+// squared distance from q to a box, 0 inside it
+static double box_distance2(double qx, double qy, double xMin, double xMax, double yMin, double yMax)
+{
+    double dx = max(0, max(xMin - qx, qx - xMax));
+    double dy = max(0, max(yMin - qy, qy - yMax));
+    return dx * dx + dy * dy;
+}
+
+// nearest_point_nifs3_2d within knot interval k
+static double nearest_in_interval(const nifs3_t *iX, const nifs3_t *iY, int k, double x, double y, double best, double *t)
+{
+    double h = iX->x[k] - iX->x[k - 1];
+    double cx[4], cy[4];
+    nifs3_interval_coeffs(iX, k, cx);
+    nifs3_interval_coeffs(iY, k, cy);
+    cx[0] -= x;
+    cy[0] -= y;
+
+    // D(s) = |C(s) - q|^2 is a sextic; its minimum over [0, h] is at an
+    // end or at a root of the quintic D'
+    double D[7] = {0};
+    for (int a = 0; a < 4; a++)
+        for (int b = 0; b < 4; b++)
+            D[a + b] += cx[a] * cx[b] + cy[a] * cy[b];
+
+    double dD[NEAREST_DEGREE + 1];
+    for (int j = 1; j <= 6; j++)
+        dD[j - 1] = j * D[j];
+
+    double s[NEAREST_DEGREE + 2];
+    int m = poly_roots(dD, NEAREST_DEGREE, 0, h, s);
+    s[m++] = 0;
+    s[m++] = h;
+
+    for (int j = 0; j < m; j++)
+    {
+        double d = poly_eval(D, 6, s[j]);
+        if (d < best)
+        {
+            best = max(d, 0);
+            *t = iX->x[k - 1] + s[j];
+        }
+    }
+    return best;
+}
+
+static double aabb_distance2(double qx, double qy, const aabb_t *b)
+{
+    return box_distance2(qx, qy, b->xMin, b->xMax, b->yMin, b->yMax);
+}
+
+double nearest_point_nifs3_2d(const nifs3_pool_t *pool, int i, double x, double y, double bound, double *t)
+{
+    const nifs3_2d_t *c = &pool->interp[i];
+    const nifs3_t *iX = c->iX, *iY = c->iY;
+    double best = bound;
+
+    if (iX->n == 1)
+    {
+        double dx = iX->y[0] - x, dy = iY->y[0] - y;
+        if (dx * dx + dy * dy < best)
+        {
+            best = dx * dx + dy * dy;
+            *t = iX->x[0];
+        }
+    }
+    if (iX->n < 2)
+        return best;
+
+    // down the interval boxes, the nearer child first, so that the bound
+    // shrinks early and prunes most of the curve
+    const aabb_t *b = c->bounds;
+    int leaves = c->bounds_leaves;
+    int stack[64];
+    int top = 0;
+    stack[top++] = 1;
+
+    while (top > 0)
+    {
+        int j = stack[--top];
+        if (aabb_distance2(x, y, &b[j]) >= best)
+            continue;
+
+        if (j >= leaves)
+            best = nearest_in_interval(iX, iY, j - leaves + 1, x, y, best, t);
+        else
+        {
+            bool left = aabb_distance2(x, y, &b[2 * j]) <= aabb_distance2(x, y, &b[2 * j + 1]);
+            stack[top++] = left ? 2 * j + 1 : 2 * j;
+            stack[top++] = left ? 2 * j : 2 * j + 1;
+        }
+    }
+    return best;
+}
+
+typedef struct
+{
+    const nifs3_pool_t *pool;
+    double x, y;
+    int i;
+    double t;
+} nearest_t;
+
+static double nearest_in(void *ctx, int i, double bound)
+{
+    nearest_t *q = ctx;
+    double d = nearest_point_nifs3_2d(q->pool, i, q->x, q->y, bound, &q->t);
+    if (d < bound)
+        q->i = i;
+    return d;
+}
+
+int nearest_nifs3_2d(const nifs3_pool_t *pool, double x, double y, double r, double *t)
+{
+    nearest_t q = {pool, x, y, -1, 0};
+    aabb_tree_nearest(&pool->tree, x, y, r * r, nearest_in, &q);
+    if (q.i != -1 && t != NULL)
+        *t = q.t;
+    return q.i;
+}
+
+bool is_live_nifs3_2d(const nifs3_pool_t *pool, int i)
+{
+    return i >= 0 && i < pool->cap && pool->interp[i].iX != NULL;
+}
+
+// takes a slot off the free list, growing the pool when it is empty
+static int alloc_nifs3_2d(nifs3_pool_t *pool)
+{
+    if (pool->free_head == -1)
+    {
+        int cap = max(16, 2 * pool->cap);
+        pool->interp = realloc(pool->interp, sizeof(nifs3_2d_t) * cap);
+        pool->live = realloc(pool->live, sizeof(int) * cap);
+        memset(&pool->interp[pool->cap], 0, sizeof(nifs3_2d_t) * (cap - pool->cap));
+
+        // chained so that the lowest new slot is handed out first
+        for (int i = cap - 1; i >= pool->cap; i--)
+        {
+            pool->interp[i].next_free = pool->free_head;
+            pool->free_head = i;
+        }
+        pool->cap = cap;
+    }
+
+    int i = pool->free_head;
+    pool->free_head = pool->interp[i].next_free;
+
+    pool->interp[i].live_index = pool->count;
+    pool->live[pool->count++] = i;
+    pool->interp[i].proxy = -1;
+    return i;
+}
+
+void free_nifs3_2d(nifs3_pool_t *pool, int i)
+{
+    if (!is_live_nifs3_2d(pool, i))
+        return;
+
+    nifs3_free(pool->interp[i].iX);
+    nifs3_free(pool->interp[i].iY);
+    free(pool->interp[i].u);
+    free(pool->interp[i].bounds);
+
+    if (pool->interp[i].proxy != -1)
+        aabb_tree_remove(&pool->tree, pool->interp[i].proxy);
+
+    // the last live handle takes the freed place in pool->live
+    int k = pool->interp[i].live_index;
+    pool->live[k] = pool->live[--pool->count];
+    pool->interp[pool->live[k]].live_index = k;
+
+    memset(&pool->interp[i], 0, sizeof(nifs3_2d_t));
+    pool->interp[i].next_free = pool->free_head;
+    pool->free_head = i;
+}
+
+void cleanup_nifs3_2d(nifs3_pool_t *pool)
+{
+    while (pool->count > 0)
+        free_nifs3_2d(pool, pool->live[pool->count - 1]);
+
+    free(pool->interp);
+    free(pool->live);
+    aabb_tree_free(&pool->tree);
+    pool->interp = NULL;
+    pool->live = NULL;
+    pool->cap = 0;
+    pool->free_head = -1;
+}
+
+void set_nifs3_2d_interpolation_pts(nifs3_pool_t *pool, int i, const double *u, int n)
+{
+    if (!is_live_nifs3_2d(pool, i))
+        return;
+
+    pool->interp[i].n = n;
+    pool->interp[i].u = realloc(pool->interp[i].u, max(sizeof(double) * n, 1));
+    if (n > 0)
+        memcpy(pool->interp[i].u, u, sizeof(double) * n);
+    touch_nifs3_2d(pool, i);
+}
+
+// takes ownership of splines built over the same knots and of u (nu
+// interpolation points)
+static int adopt_nifs3_2d(nifs3_pool_t *pool, nifs3_t *iX, nifs3_t *iY, double *u, int nu)
+{
+    int i = alloc_nifs3_2d(pool);
+
+    pool->interp[i].iX = iX;
+    pool->interp[i].iY = iY;
+    pool->interp[i].u = u;
+    pool->interp[i].n = nu;
+
+    fit_nifs3_2d(pool, i, 1, iX->n - 1);
+    return i;
+}
+
+int create_nifs3_2d(nifs3_pool_t *pool, const double *x, const double *y, const double *t, int n)
+{
+    nifs3_t *iX, *iY;
+    nifs3_init_2d(t, x, y, n, true, &iX, &iY);
+
+    // t may be NULL for an empty curve, and memcpy must not get NULL
+    double *u = malloc(max(sizeof(double) * n, 1));
+    if (n > 0)
+        memcpy(u, t, sizeof(double) * n);
+
+    return adopt_nifs3_2d(pool, iX, iY, u, n);
+}
+
+// whether the knots are linspace(0, 1, n), up to the rounding that repeated
+// nifs3_scale_knots leaves
+static bool uniform_knots(const nifs3_t *interp)
+{
+    int n = interp->n;
+    if (n == 1)
+        return interp->x[0] == 0;
+    for (int k = 0; k < n; k++)
+        if (fabs(interp->x[k] - (double)k / (n - 1)) > 1e-9)
+            return false;
+    return true;
+}
+
+void add_node_nifs3_2d(nifs3_pool_t *pool, int i, double x, double y)
+{
+    if (!is_live_nifs3_2d(pool, i))
+        return;
+
+    nifs3_t *iX = pool->interp[i].iX, *iY = pool->interp[i].iY;
+    int n = iX->n;
+    int from = 1;
+
+    if (uniform_knots(iX))
+    {
+        // the old knots become the first n points of linspace(0, 1, n + 1)
+        if (n >= 2)
+        {
+            nifs3_scale_knots(iX, (double)(n - 1) / n);
+            nifs3_scale_knots(iY, (double)(n - 1) / n);
+        }
+
+        double t = n == 0 ? 0 : 1;
+        int fromX = nifs3_append(iX, t, x);
+        int fromY = nifs3_append(iY, t, y);
+        // scaling the knots leaves the curve's shape, and so the boxes, as is
+        from = min(fromX, fromY);
+    }
+    else
+    {
+        // knots from a file can be anything, so rebuild over the new ones
+        double *t = alloc_linspace(0, 1, n + 1);
+        double *px = malloc(sizeof(double) * (n + 1));
+        double *py = malloc(sizeof(double) * (n + 1));
+        memcpy(px, iX->y, sizeof(double) * n);
+        memcpy(py, iY->y, sizeof(double) * n);
+        px[n] = x;
+        py[n] = y;
+
+        nifs3_free(iX);
+        nifs3_free(iY);
+        nifs3_init_2d(t, px, py, n + 1, true, &pool->interp[i].iX, &pool->interp[i].iY);
+        free(t);
+        free(px);
+        free(py);
+    }
+
+    pool->interp[i].n = 10 * (n + 1);
+    pool->interp[i].u = realloc(pool->interp[i].u, sizeof(double) * pool->interp[i].n);
+    linspace(0, 1, pool->interp[i].n, pool->interp[i].u);
+    fit_nifs3_2d(pool, i, from, n);
+}
+
+void set_node_nifs3_2d(nifs3_pool_t *pool, int i, int k, double x, double y)
+{
+    if (!is_live_nifs3_2d(pool, i) || k < 0 || k >= pool->interp[i].iX->n)
+        return;
+
+    int toX, toY;
+    int fromX = nifs3_set_value(pool->interp[i].iX, k, x, &toX);
+    int fromY = nifs3_set_value(pool->interp[i].iY, k, y, &toY);
+    fit_nifs3_2d(pool, i, min(fromX, fromY), max(toX, toY));
+}
+
+void eval_nifs3_2d_sorted(const nifs3_pool_t *pool, int i, const double *u, int m, double *x, double *y)
+{
+    const nifs3_t *iX = pool->interp[i].iX;
+    const nifs3_t *iY = pool->interp[i].iY;
+    assert(iX->n == iY->n);
+
+    if (iX->n <= 1 || m == 0)
+    {
+        nifs3_eval_sorted(iX, u, m, x);
+        nifs3_eval_sorted(iY, u, m, y);
+        return;
+    }
+
+    // both coordinates are interpolated over the same knots, so they share
+    // a single interval cursor
+    int k = nifs3_find_interval(iX, u[0]);
+    for (int j = 0; j < m; j++)
+    {
+        if (!nifs3_in_range(iX, u[j]))
+        {
+            x[j] = y[j] = 0;
+            continue;
+        }
+
+        k = nifs3_advance(iX, k, u[j]);
+        x[j] = nifs3_eval_interval(iX, k, u[j]);
+        y[j] = nifs3_eval_interval(iY, k, u[j]);
+    }
+}
+
+///////////// SIMD batch evaluation //////////////
+// All paths below take non-empty, in-range, non-decreasing u and splines
+// with coefficients over the same knots, and write interleaved x/y pairs.
+typedef void (*eval_block_fn)(const nifs3_t *iX, const nifs3_t *iY,
+                              const double *u, int m, double *xy);
+
+static void eval_block_scalar(const nifs3_t *iX, const nifs3_t *iY,
+                              const double *u, int m, double *xy)
+{
+    int k = nifs3_find_interval(iX, u[0]);
+    for (int j = 0; j < m; j++)
+    {
+        k = nifs3_advance(iX, k, u[j]);
+        double s = u[j] - iX->x[k - 1];
+        const double *cx = &iX->c[4 * (k - 1)];
+        const double *cy = &iY->c[4 * (k - 1)];
+
+        xy[2 * j] = cx[0] + s * (cx[1] + s * (cx[2] + s * cx[3]));
+        xy[2 * j + 1] = cy[0] + s * (cy[1] + s * (cy[2] + s * cy[3]));
+    }
+}
+
+#ifdef NIFS3_X86
+// one parameter per iteration, x and y in the two lanes: the result is
+// already an interleaved pair
+__attribute__((target("sse2"))) static void eval_block_sse2(const nifs3_t *iX, const nifs3_t *iY,
+                                                            const double *u, int m, double *xy)
+{
+    int k = nifs3_find_interval(iX, u[0]);
+    for (int j = 0; j < m; j++)
+    {
+        k = nifs3_advance(iX, k, u[j]);
+        const double *cx = &iX->c[4 * (k - 1)];
+        const double *cy = &iY->c[4 * (k - 1)];
+
+        __m128d ab_x = _mm_loadu_pd(cx), cd_x = _mm_loadu_pd(cx + 2);
+        __m128d ab_y = _mm_loadu_pd(cy), cd_y = _mm_loadu_pd(cy + 2);
+
+        __m128d s = _mm_set1_pd(u[j] - iX->x[k - 1]);
+        __m128d r = _mm_unpackhi_pd(cd_x, cd_y);
+        r = _mm_add_pd(_mm_unpacklo_pd(cd_x, cd_y), _mm_mul_pd(s, r));
+        r = _mm_add_pd(_mm_unpackhi_pd(ab_x, ab_y), _mm_mul_pd(s, r));
+        r = _mm_add_pd(_mm_unpacklo_pd(ab_x, ab_y), _mm_mul_pd(s, r));
+
+        _mm_storeu_pd(xy + 2 * j, r);
+    }
+}
+
+// transposes the (a, b, c, d) rows of four intervals into a, b, c, d columns
+#define TRANSPOSE4(r0, r1, r2, r3, a, b, c, d)                     \
+    do                                                             \
+    {                                                              \
+        __m256d t0 = _mm256_unpacklo_pd(r0, r1); /* a0 a1 c0 c1 */ \
+        __m256d t1 = _mm256_unpackhi_pd(r0, r1); /* b0 b1 d0 d1 */ \
+        __m256d t2 = _mm256_unpacklo_pd(r2, r3);                   \
+        __m256d t3 = _mm256_unpackhi_pd(r2, r3);                   \
+        a = _mm256_permute2f128_pd(t0, t2, 0x20);                  \
+        b = _mm256_permute2f128_pd(t1, t3, 0x20);                  \
+        c = _mm256_permute2f128_pd(t0, t2, 0x31);                  \
+        d = _mm256_permute2f128_pd(t1, t3, 0x31);                  \
+    } while (0)
+
+// four parameters per iteration: the coefficient rows of each lane are
+// transposed in registers (gathers are microcoded and slower on most
+// hosts), then x and y are interleaved with two unpacks and lane permutes
+__attribute__((target("avx2,fma"))) static void eval_block_avx2(const nifs3_t *iX, const nifs3_t *iY,
+                                                                const double *u, int m, double *xy)
+{
+    int k = nifs3_find_interval(iX, u[0]);
+    int j = 0;
+    for (; j + 4 <= m; j += 4)
+    {
+        int k0 = k = nifs3_advance(iX, k, u[j]);
+        int k1 = k = nifs3_advance(iX, k, u[j + 1]);
+        int k2 = k = nifs3_advance(iX, k, u[j + 2]);
+        int k3 = k = nifs3_advance(iX, k, u[j + 3]);
+
+        __m256d knot = _mm256_set_pd(iX->x[k3 - 1], iX->x[k2 - 1], iX->x[k1 - 1], iX->x[k0 - 1]);
+        __m256d s = _mm256_sub_pd(_mm256_loadu_pd(u + j), knot);
+
+        __m256d a, b, c, d;
+        TRANSPOSE4(_mm256_loadu_pd(&iX->c[4 * (k0 - 1)]), _mm256_loadu_pd(&iX->c[4 * (k1 - 1)]),
+                   _mm256_loadu_pd(&iX->c[4 * (k2 - 1)]), _mm256_loadu_pd(&iX->c[4 * (k3 - 1)]),
+                   a, b, c, d);
+        __m256d x = _mm256_fmadd_pd(_mm256_fmadd_pd(_mm256_fmadd_pd(d, s, c), s, b), s, a);
+
+        TRANSPOSE4(_mm256_loadu_pd(&iY->c[4 * (k0 - 1)]), _mm256_loadu_pd(&iY->c[4 * (k1 - 1)]),
+                   _mm256_loadu_pd(&iY->c[4 * (k2 - 1)]), _mm256_loadu_pd(&iY->c[4 * (k3 - 1)]),
+                   a, b, c, d);
+        __m256d y = _mm256_fmadd_pd(_mm256_fmadd_pd(_mm256_fmadd_pd(d, s, c), s, b), s, a);
+
+        __m256d lo = _mm256_unpacklo_pd(x, y); // x0 y0 x2 y2
+        __m256d hi = _mm256_unpackhi_pd(x, y); // x1 y1 x3 y3
+        _mm256_storeu_pd(xy + 2 * j, _mm256_permute2f128_pd(lo, hi, 0x20));
+        _mm256_storeu_pd(xy + 2 * j + 4, _mm256_permute2f128_pd(lo, hi, 0x31));
+    }
+
+    if (j < m)
+        eval_block_scalar(iX, iY, u + j, m - j, xy + 2 * j);
+}
+#endif
+
+// picked on first use unless nifs3_set_isa came first; atomic, as any
+// thread may get there
+static _Atomic(eval_block_fn) eval_block_impl;
+
+nifs3_isa_t nifs3_isa_supported()
+{
+#ifdef NIFS3_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return NIFS3_ISA_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return NIFS3_ISA_SSE2;
+#endif
+    return NIFS3_ISA_SCALAR;
+}
+
+// the path for isa, clamped to what the CPU supports; *isa gets the one
+// it is for
+static eval_block_fn select_isa(nifs3_isa_t *isa)
+{
+    switch (min(*isa, nifs3_isa_supported()))
+    {
+#ifdef NIFS3_X86
+    case NIFS3_ISA_AVX2:
+        *isa = NIFS3_ISA_AVX2;
+        return eval_block_avx2;
+    case NIFS3_ISA_SSE2:
+        *isa = NIFS3_ISA_SSE2;
+        return eval_block_sse2;
+#endif
+    default:
+        *isa = NIFS3_ISA_SCALAR;
+        return eval_block_scalar;
+    }
+}
+
+nifs3_isa_t nifs3_set_isa(nifs3_isa_t isa)
+{
+    atomic_store(&eval_block_impl, select_isa(&isa));
+    return isa;
+}
+
+static void eval_block(const nifs3_t *iX, const nifs3_t *iY, const double *u, int m, double *xy)
+{
+    assert(iX->n == iY->n);
+
+    if (iX->n <= 1 || iX->c == NULL || iY->c == NULL)
+    {
+        for (int j = 0; j < m; j++)
+        {
+            xy[2 * j] = nifs3_get(iX, u[j]);
+            xy[2 * j + 1] = nifs3_get(iY, u[j]);
+        }
+        return;
+    }
+
+    // in a sorted sweep out of range parameters can only sit at the ends
+    int lo = 0, hi = m;
+    for (; lo < hi && !nifs3_in_range(iX, u[lo]); lo++)
+        xy[2 * lo] = xy[2 * lo + 1] = 0;
+    for (; hi > lo && !nifs3_in_range(iX, u[hi - 1]); hi--)
+        xy[2 * hi - 2] = xy[2 * hi - 1] = 0;
+
+    if (lo == hi)
+        return;
+
+    eval_block_fn impl = atomic_load(&eval_block_impl);
+    if (impl == NULL)
+    {
+        // the best path, unless another thread has already set one
+        nifs3_isa_t isa = NIFS3_ISA_AVX2;
+        eval_block_fn none = NULL;
+        impl = select_isa(&isa);
+        if (!atomic_compare_exchange_strong(&eval_block_impl, &none, impl))
+            impl = none;
+    }
+
+    impl(iX, iY, u + lo, hi - lo, xy + 2 * lo);
+}
+
+void eval_nifs3_2d_block(const nifs3_pool_t *pool, int i, const double *u, int m, double *xy)
+{
+    eval_block(pool->interp[i].iX, pool->interp[i].iY, u, m, xy);
+}
+
+///////////// Optimizing interpolation points //////////////
+// Segments still to split are kept on an explicit stack instead of the call
+// stack, so the depth of the split tree (O(n) for a bad curve) costs stack
+// entries, not frames. Each split compares the squared cross product with
+// epsilon^2 |chord|^2 instead of normalizing the chord with a square root.
+int douglas_prucker(const double *xy, int n, double epsilon, bool *keep, int *stack)
+{
+    if (n <= 0)
+        return 0;
+
+    memset(keep, 0, sizeof(bool) * n);
+    keep[0] = keep[n - 1] = true;
+    int kept = n == 1 ? 1 : 2;
+
+    double eps2 = epsilon < 0 ? -1 : epsilon * epsilon;
+
+    // the interiors of the segments on the stack are disjoint and never
+    // empty, so there are fewer than n of them
+    int top = 0;
+    if (n > 2)
+    {
+        stack[top++] = 0;
+        stack[top++] = n - 1;
+    }
+
+    while (top > 0)
+    {
+        int last = stack[--top];
+        int first = stack[--top];
+
+        double x0 = xy[2 * first], y0 = xy[2 * first + 1];
+        double dx = xy[2 * last] - x0;
+        double dy = xy[2 * last + 1] - y0;
+
+        double len2 = dx * dx + dy * dy;
+
+        // a closed segment (chord of length 0) measures the squared
+        // distance from its end instead
+        double dmax = -1;
+        int index = first;
+
+        for (int i = first + 1; i < last; i++)
+        {
+            double ex = xy[2 * i] - x0, ey = xy[2 * i + 1] - y0;
+            double d = len2 > 0 ? fabs(ex * dy - ey * dx) : ex * ex + ey * ey;
+            if (d > dmax)
+            {
+                index = i;
+                dmax = d;
+            }
+        }
+
+        if (len2 > 0 ? dmax * dmax > eps2 * len2 : dmax > eps2)
+        {
+            keep[index] = true;
+            kept++;
+
+            if (last - index >= 2)
+            {
+                stack[top++] = index;
+                stack[top++] = last;
+            }
+            if (index - first >= 2)
+            {
+                stack[top++] = first;
+                stack[top++] = index;
+            }
+        }
+    }
+
+    return kept;
+}
+
+// Samples of a curve, parameters in u and interleaved points in xy
+typedef struct
+{
+    double *u, *xy;
+    int n, cap;
+} samples_t;
+
+static void push_sample(samples_t *s, double u, const double *p)
+{
+    if (s->n == s->cap)
+    {
+        s->cap = max(64, 2 * s->cap);
+        s->u = realloc(s->u, sizeof(double) * s->cap);
+        s->xy = realloc(s->xy, sizeof(double) * 2 * s->cap);
+    }
+    s->u[s->n] = u;
+    s->xy[2 * s->n] = p[0];
+    s->xy[2 * s->n + 1] = p[1];
+    s->n++;
+}
+
+// whether p is farther than sqrt(tol2) from the segment a-b
+static inline bool off_chord(const double *a, const double *b, const double *p, double tol2)
+{
+    double dx = b[0] - a[0], dy = b[1] - a[1];
+    double ex = p[0] - a[0], ey = p[1] - a[1];
+    double len2 = dx * dx + dy * dy;
+    double dot = ex * dx + ey * dy;
+
+    if (dot <= 0)
+        return ex * ex + ey * ey > tol2;
+    if (dot >= len2)
+        return (p[0] - b[0]) * (p[0] - b[0]) + (p[1] - b[1]) * (p[1] - b[1]) > tol2;
+
+    double cross = ex * dy - ey * dx;
+    return cross * cross > tol2 * len2;
+}
+
+// bisections of a knot interval at most, so tol <= 0 still terminates
+#define ADAPTIVE_MAX_DEPTH 12
+
+// Bound on |C''(t)| over knot interval k of the curve C = (iX, iY). Both
+// second derivatives are linear between the knots, so each is largest in
+// magnitude at an end. A chord of the curve over a parameter range of
+// length d then stays within d^2 / 8 * bound of it.
+static inline double flatness_bound(const nifs3_t *iX, const nifs3_t *iY, int k)
+{
+    double mx = max(fabs(iX->M[k - 1]), fabs(iX->M[k]));
+    double my = max(fabs(iY->M[k - 1]), fabs(iY->M[k]));
+    return hypot(mx, my);
+}
+
+// A piece [a, b] of knot interval k with the curve at a, b and the midpoint
+typedef struct
+{
+    double a, b;
+    double pa[2], pm[2], pb[2];
+    int depth;
+} piece_t;
+
+static inline void eval_point(const nifs3_t *iX, const nifs3_t *iY, int k, double t, double *p)
+{
+    p[0] = nifs3_eval_interval(iX, k, t);
+    p[1] = nifs3_eval_interval(iY, k, t);
+}
+
+// Samples every knot interval, bisecting a piece until the curve at its
+// midpoint and quarter points is within tol of its chord. Every knot is a
+// sample, the rest go only where the curve bends. A piece the flatness
+// bound already proves flat is taken without evaluating anything; any
+// other costs two evaluations (its midpoint is a quarter point of its
+// parent). Gives up, returning false, once *cancel (if not NULL) is set.
+static bool sample_adaptive(const nifs3_t *iX, const nifs3_t *iY, double tol, const atomic_bool *cancel,
+                            samples_t *out)
+{
+    double tol2 = tol * tol;
+    piece_t stack[ADAPTIVE_MAX_DEPTH + 2];
+
+    for (int k = 1; k < iX->n; k++)
+    {
+        if (cancel != NULL && atomic_load_explicit(cancel, memory_order_relaxed))
+            return false;
+
+        // flat once (b - a)^2 / 8 * bound <= tol
+        double flat_len2 = 8 * tol / flatness_bound(iX, iY, k);
+
+        piece_t root = {iX->x[k - 1], iX->x[k], {iX->y[k - 1], iY->y[k - 1]}, {0}, {iX->y[k], iY->y[k]}, 0};
+        if ((root.b - root.a) * (root.b - root.a) <= flat_len2)
+        {
+            push_sample(out, root.a, root.pa);
+            continue;
+        }
+        eval_point(iX, iY, k, (root.a + root.b) / 2, root.pm);
+
+        int top = 0;
+        stack[top++] = root;
+
+        // left pieces are pushed last, so samples come out in order
+        while (top > 0)
+        {
+            piece_t p = stack[--top];
+            double m = (p.a + p.b) / 2;
+
+            if ((p.b - p.a) * (p.b - p.a) <= flat_len2)
+            {
+                push_sample(out, p.a, p.pa);
+                continue;
+            }
+
+            double q1[2], q3[2];
+            eval_point(iX, iY, k, (p.a + m) / 2, q1);
+            eval_point(iX, iY, k, (m + p.b) / 2, q3);
+
+            if (p.depth == ADAPTIVE_MAX_DEPTH ||
+                (!off_chord(p.pa, p.pb, p.pm, tol2) && !off_chord(p.pa, p.pb, q1, tol2) &&
+                 !off_chord(p.pa, p.pb, q3, tol2)))
+            {
+                push_sample(out, p.a, p.pa);
+                continue;
+            }
+
+            piece_t right = {m, p.b, {p.pm[0], p.pm[1]}, {q3[0], q3[1]}, {p.pb[0], p.pb[1]}, p.depth + 1};
+            piece_t left = {p.a, m, {p.pa[0], p.pa[1]}, {q1[0], q1[1]}, {p.pm[0], p.pm[1]}, p.depth + 1};
+            stack[top++] = right;
+            stack[top++] = left;
+        }
+    }
+
+    int n = iX->n;
+    push_sample(out, iX->x[n - 1], (double[]){iX->y[n - 1], iY->y[n - 1]});
+    return true;
+}
+
+int tessellate_nifs3_2d(const nifs3_pool_t *pool, int i, double tol, double **pts)
+{
+    const nifs3_t *iX = pool->interp[i].iX, *iY = pool->interp[i].iY;
+    int n = iX->n;
+
+    if (n < 2)
+    {
+        *pts = malloc(sizeof(double) * max(n, 1));
+        memcpy(*pts, iX->x, sizeof(double) * n);
+        return n;
+    }
+
+    // pieces per knot interval, counted first so u is allocated once
+    int *pieces = malloc(sizeof(int) * n);
+    int count = 1;
+    for (int k = 1; k < n; k++)
+    {
+        double h = iX->x[k] - iX->x[k - 1];
+        double p = ceil(h * sqrt(flatness_bound(iX, iY, k) / (8 * tol)));
+        pieces[k] = p >= 1 ? (int)min(p, TESSELLATE_MAX_PIECES) : 1;
+        count += pieces[k];
+    }
+
+    double *u = malloc(sizeof(double) * count);
+    int j = 0;
+    for (int k = 1; k < n; k++)
+    {
+        double a = iX->x[k - 1], h = iX->x[k] - a;
+        for (int p = 0; p < pieces[k]; p++)
+            u[j++] = a + h * p / pieces[k];
+    }
+    u[j++] = iX->x[n - 1];
+
+    free(pieces);
+    *pts = u;
+    return count;
+}
+
+// simplify_nifs3_2d, which returns -1 (leaving *pts) if *cancel (if not
+// NULL) gets set while it samples
+static int simplify(const nifs3_t *iX, const nifs3_t *iY, double epsilon, const atomic_bool *cancel,
+                    double **pts)
+{
+    int n = iX->n;
+    if (n < 2)
+    {
+        *pts = malloc(sizeof(double) * max(n, 1));
+        memcpy(*pts, iX->x, sizeof(double) * n);
+        return n;
+    }
+
+    samples_t s = {0};
+    if (!sample_adaptive(iX, iY, epsilon * OPTIMIZE_TOLERANCE, cancel, &s))
+    {
+        free(s.u);
+        free(s.xy);
+        return -1;
+    }
+
+    // the samples are within OPTIMIZE_TOLERANCE * epsilon of the curve, so
+    // the polyline gets the rest of epsilon
+    bool *keep = malloc(sizeof(bool) * s.n);
+    int *stack = malloc(sizeof(int) * 2 * s.n);
+    douglas_prucker(s.xy, s.n, epsilon * (1 - OPTIMIZE_TOLERANCE), keep, stack);
+    free(stack);
+    free(s.xy);
+
+    int count = 0;
+    for (int j = 0; j < s.n; j++)
+        if (keep[j])
+            s.u[count++] = s.u[j];
+    free(keep);
+
+    *pts = realloc(s.u, sizeof(double) * count);
+    return count;
+}
+
+int simplify_nifs3_2d(const nifs3_pool_t *pool, int i, double epsilon, double **u)
+{
+    return simplify(pool->interp[i].iX, pool->interp[i].iY, epsilon, NULL, u);
+}
+
+void optimize_nifs3_2d(nifs3_pool_t *pool, int i, double epsilon)
+{
+    if (!is_live_nifs3_2d(pool, i))
+        return;
+
+    double *u;
+    int n = simplify_nifs3_2d(pool, i, epsilon, &u);
+    set_nifs3_2d_interpolation_pts(pool, i, u, n);
+    free(u);
+}
+
+typedef struct
+{
+    const nifs3_pool_t *pool;
+    double epsilon;
+    double **u;
+    int *n;
+} optimize_all_t;
+
+static void optimize_one(void *ctx, int k, int worker)
+{
+    (void)worker;
+    optimize_all_t *job = ctx;
+    job->n[k] = simplify_nifs3_2d(job->pool, job->pool->live[k], job->epsilon, &job->u[k]);
+}
+
+void optimize_all_nifs3_2d(nifs3_pool_t *pool, double epsilon)
+{
+    int count = pool->count;
+    optimize_all_t job = {pool, epsilon, malloc(sizeof(double *) * max(count, 1)), malloc(sizeof(int) * max(count, 1))};
+
+    parallel_for(count, optimize_one, &job);
+
+    for (int k = 0; k < count; k++)
+    {
+        set_nifs3_2d_interpolation_pts(pool, pool->live[k], job.u[k], job.n[k]);
+        free(job.u[k]);
+    }
+    free(job.u);
+    free(job.n);
+}
+
+// The job works on copies of the splines, so the pool can change while it
+// runs; a curve only gets its new points if its version is still the one
+// the job saw.
+struct optimize_job
+{
+    nifs3_pool_t *pool;
+    int count;
+    int *handles;
+    unsigned *versions;
+    nifs3_t **iX, **iY;
+    double epsilon;
+
+    double **u;
+    int *n; // -1 for curves skipped after a cancel
+
+    atomic_int finished;
+    atomic_bool cancelled, done;
+    pthread_t thread;
+    bool threaded; // false if the job had to run in start_optimize_job
+};
+
+static void optimize_job_one(void *ctx, int k, int worker)
+{
+    (void)worker;
+    optimize_job_t *job = ctx;
+    if (atomic_load(&job->cancelled))
+        return;
+
+    // a cancel stops a long curve part way; n[k] stays -1 then
+    int n = simplify(job->iX[k], job->iY[k], job->epsilon, &job->cancelled, &job->u[k]);
+    if (n < 0)
+        return;
+    job->n[k] = n;
+    atomic_fetch_add(&job->finished, 1);
+}
+
+static void *optimize_job_main(void *arg)
+{
+    optimize_job_t *job = arg;
+    parallel_for(job->count, optimize_job_one, job);
+    atomic_store(&job->done, true);
+    return NULL;
+}
+
+optimize_job_t *start_optimize_job(nifs3_pool_t *pool, const int *handles, int count, double epsilon)
+{
+    optimize_job_t *job = calloc(1, sizeof(optimize_job_t));
+    int cap = max(count, 1);
+    job->pool = pool;
+    job->count = count;
+    job->epsilon = epsilon;
+    job->handles = malloc(sizeof(int) * cap);
+    job->versions = malloc(sizeof(unsigned) * cap);
+    job->iX = malloc(sizeof(nifs3_t *) * cap);
+    job->iY = malloc(sizeof(nifs3_t *) * cap);
+    job->u = calloc(cap, sizeof(double *));
+    job->n = malloc(sizeof(int) * cap);
+    atomic_init(&job->finished, 0);
+    atomic_init(&job->cancelled, false);
+    atomic_init(&job->done, false);
+
+    for (int k = 0; k < count; k++)
+    {
+        int i = handles[k];
+        job->handles[k] = i;
+        job->versions[k] = pool->interp[i].version;
+        job->iX[k] = nifs3_copy(pool->interp[i].iX);
+        job->iY[k] = nifs3_copy(pool->interp[i].iY);
+        job->n[k] = -1;
+    }
+
+    job->threaded = pthread_create(&job->thread, NULL, optimize_job_main, job) == 0;
+    if (!job->threaded)
+        optimize_job_main(job);
+    return job;
+}
+
+int optimize_job_progress(const optimize_job_t *job, int *total)
+{
+    *total = job->count;
+    return atomic_load(&job->finished);
+}
+
+bool optimize_job_done(const optimize_job_t *job)
+{
+    return atomic_load(&job->done);
+}
+
+void cancel_optimize_job(optimize_job_t *job)
+{
+    atomic_store(&job->cancelled, true);
+}
+
+int finish_optimize_job(optimize_job_t *job)
+{
+    if (job->threaded)
+        pthread_join(job->thread, NULL);
+
+    nifs3_pool_t *pool = job->pool;
+    int updated = 0;
+    for (int k = 0; k < job->count; k++)
+    {
+        int i = job->handles[k];
+        if (!atomic_load(&job->cancelled) && job->n[k] >= 0 && is_live_nifs3_2d(pool, i) &&
+            pool->interp[i].version == job->versions[k])
+        {
+            set_nifs3_2d_interpolation_pts(pool, i, job->u[k], job->n[k]);
+            updated++;
+        }
+
+        free(job->u[k]);
+        nifs3_free(job->iX[k]);
+        nifs3_free(job->iY[k]);
+    }
+
+    free(job->handles);
+    free(job->versions);
+    free(job->iX);
+    free(job->iY);
+    free(job->u);
+    free(job->n);
+    free(job);
+    return updated;
+}
+
+///////////// Loading 2d interpolators from file //////////////
+// The .data format: per curve, one line each of x, y, t and u values,
+// curves separated by a blank line. Files are memory-mapped and parsed in
+// place.
+
+static const double exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// strtod on a NUL-terminated copy of the token at p, for everything the
+// fast path does not cover (long mantissas, large exponents, inf, nan, hex)
+static const char *parse_double_slow(const char *p, const char *end, double *out)
+{
+    const char *q = p;
+    while (q < end && !isspace((unsigned char)*q))
+        q++;
+
+    char small[64];
+    char *buf = q - p < (long)sizeof(small) ? small : malloc(q - p + 1);
+    memcpy(buf, p, q - p);
+    buf[q - p] = '\0';
+
+    char *stop;
+    *out = strtod(buf, &stop);
+    q = p + (stop - buf);
+
+    if (buf != small)
+        free(buf);
+    return q;
+}
+
+// Parses the number at p, returns the end of it (p itself if there is
+// none). The result is bit-identical to strtod: a mantissa of at most 19
+// significant digits that fits in 53 bits, scaled by an exact power of ten
+// up to 1e22, is correctly rounded by a single multiplication or division
+// (Clinger's fast path); anything else goes to strtod.
+static const char *parse_double(const char *p, const char *end, double *out)
+{
+    const char *start = p;
+
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        neg = *p++ == '-';
+
+    uint64_t m = 0;
+    int sig = 0, exp10 = 0;
+    bool digits = false, exact = true;
+
+    for (; p < end && isdigit((unsigned char)*p); p++)
+    {
+        digits = true;
+        if (m == 0 && *p == '0')
+            continue;
+        if (sig++ < 19)
+            m = m * 10 + (*p - '0');
+        else
+            exact = false;
+    }
+
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && isdigit((unsigned char)*p); p++)
+        {
+            digits = true;
+            if (m == 0 && *p == '0')
+            {
+                exp10--;
+                continue;
+            }
+            if (sig++ < 19)
+            {
+                m = m * 10 + (*p - '0');
+                exp10--;
+            }
+            else
+                exact = false;
+        }
+    }
+
+    // inf, nan, hexadecimal ("0x") and the like
+    if (!digits || (p < end && (*p == 'x' || *p == 'X')))
+        return parse_double_slow(start, end, out);
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char *q = p + 1;
+        bool eneg = false;
+        if (q < end && (*q == '-' || *q == '+'))
+            eneg = *q++ == '-';
+
+        if (q < end && isdigit((unsigned char)*q))
+        {
+            int e = 0;
+            for (; q < end && isdigit((unsigned char)*q); q++)
+                e = min(e * 10 + (*q - '0'), 100000);
+            exp10 += eneg ? -e : e;
+            p = q;
+        }
+    }
+
+    if (!exact || m > (1ull << 53) || (m != 0 && (exp10 < -22 || exp10 > 22)))
+        return parse_double_slow(start, end, out);
+
+    double v = (double)m;
+    if (m != 0)
+        v = exp10 < 0 ? v / exact_pow10[-exp10] : v * exact_pow10[exp10];
+
+    *out = neg ? -v : v;
+    return p;
+}
+
+typedef struct
+{
+    double *data;
+    int n, cap;
+} line_t;
+
+// Reads one line of numbers into line. Like the %lf conversion of scanf it
+// first skips any whitespace, newlines included, so blank lines between
+// curves vanish; then it reads numbers up to the end of the line.
+static const char *parse_line(const char *p, const char *end, line_t *line)
+{
+    line->n = 0;
+
+    while (p < end && isspace((unsigned char)*p))
+        p++;
+
+    while (p < end)
+    {
+        double v;
+        const char *q = parse_double(p, end, &v);
+        if (q == p)
+            break;
+
+        if (line->n == line->cap)
+        {
+            line->cap = max(32, 2 * line->cap);
+            line->data = realloc(line->data, sizeof(double) * line->cap);
+        }
+        line->data[line->n++] = v;
+
+        p = q;
+        while (p < end && *p != '\n' && isspace((unsigned char)*p))
+            p++;
+
+        if (p == end || *p == '\n')
+        {
+            if (p < end)
+                p++;
+            break;
+        }
+    }
+
+    return p;
+}
+
+// maps the whole file read-only; *size is 0 and the result NULL for an
+// empty file
+static const char *map_file(const char *path, size_t *size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return MAP_FAILED;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        close(fd);
+        return MAP_FAILED;
+    }
+
+    *size = st.st_size;
+    if (*size == 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data != MAP_FAILED)
+        madvise(data, *size, MADV_SEQUENTIAL);
+    return data;
+}
+
+// Every curve is four non-blank lines, so the file is split into curves
+// with a plain line scan; parsing them and building the splines, which is
+// nearly all of the work, then runs on parallel_for workers. The curves
+// join the pool in file order afterwards.
+typedef struct
+{
+    const char *begin, *end;
+    int counts[4]; // values read from the x, y, t and u lines
+    nifs3_t *iX, *iY;
+    double *u;
+} text_curve_t;
+
+typedef struct
+{
+    text_curve_t *curves;
+    line_t *lines; // four per worker
+} text_load_t;
+
+static bool is_blank(const char *p, const char *end)
+{
+    while (p < end && isspace((unsigned char)*p))
+        p++;
+    return p == end;
+}
+
+// fills *curves with the extent of every curve, returns their number
+static int split_curves(const char *data, const char *end, text_curve_t **curves)
+{
+    int count = 0, cap = 0, lines = 0;
+    *curves = NULL;
+
+    for (const char *p = data; p < end;)
+    {
+        const char *nl = memchr(p, '\n', end - p);
+        const char *line_end = nl != NULL ? nl : end;
+
+        if (!is_blank(p, line_end) && lines++ % 4 == 0)
+        {
+            if (count == cap)
+            {
+                cap = max(64, 2 * cap);
+                *curves = realloc(*curves, sizeof(text_curve_t) * cap);
+            }
+            if (count > 0)
+                (*curves)[count - 1].end = p;
+            (*curves)[count++] = (text_curve_t){.begin = p};
+        }
+
+        p = nl != NULL ? nl + 1 : end;
+    }
+
+    if (count > 0)
+        (*curves)[count - 1].end = end;
+    return count;
+}
+
+static void parse_curve(void *ctx, int k, int worker)
+{
+    text_load_t *load = ctx;
+    text_curve_t *c = &load->curves[k];
+    line_t *l = &load->lines[4 * worker];
+
+    const char *p = c->begin;
+    for (int j = 0; j < 4; j++)
+    {
+        p = parse_line(p, c->end, &l[j]);
+        c->counts[j] = l[j].n;
+    }
+
+    int n = l[2].n, nu = l[3].n;
+    if (l[0].n != n || l[1].n != n || n == 0 || nu == 0)
+        return;
+
+    nifs3_init_2d(l[2].data, l[0].data, l[1].data, n, true, &c->iX, &c->iY);
+    c->u = malloc(sizeof(double) * nu);
+    memcpy(c->u, l[3].data, sizeof(double) * nu);
+}
+
+static bool load_text(nifs3_pool_t *pool, const char *data, size_t size)
+{
+    text_load_t load;
+    int count = split_curves(data, data + size, &load.curves);
+
+    int workers = parallel_threads();
+    load.lines = calloc(4 * workers, sizeof(line_t));
+
+    parallel_for(count, parse_curve, &load);
+
+    bool ok = true, done = false;
+    for (int k = 0; k < count; k++)
+    {
+        text_curve_t *c = &load.curves[k];
+        const int *n = c->counts;
+
+        // a curve without a single number ends the file, as with fscanf
+        if (n[0] == 0 && n[1] == 0 && n[2] == 0 && n[3] == 0)
+            done = true;
+
+        if (ok && !done && c->iX == NULL)
+        {
+            printf("Invalid file format (%d %d %d %d)\n", n[0], n[1], n[2], n[3]);
+            ok = false;
+        }
+
+        if (ok && !done)
+            adopt_nifs3_2d(pool, c->iX, c->iY, c->u, n[3]);
+        else
+        {
+            nifs3_free(c->iX);
+            nifs3_free(c->iY);
+            free(c->u);
+        }
+    }
+
+    for (int j = 0; j < 4 * workers; j++)
+        free(load.lines[j].data);
+    free(load.lines);
+    free(load.curves);
+
+    return ok;
+}
+
+///////////// Binary file format //////////////
+// Version 1, all integers and doubles little-endian:
+//   char magic[8] = "NIFS3BIN"
+//   uint32 version, uint32 count
+//   struct { uint32 n, nu; } counts[count]
+//   per curve: double x[n], y[n], t[n], u[nu]
+// The header is 16 bytes and every count entry 8, so on a little-endian
+// host the arrays are read straight out of the (page-aligned) mapping.
+
+static const char binary_magic[8] = {'N', 'I', 'F', 'S', '3', 'B', 'I', 'N'};
+#define BINARY_VERSION 1
+
+static bool is_little_endian()
+{
+    const uint16_t one = 1;
+    return *(const uint8_t *)&one == 1;
+}
+
+static uint32_t swap32(uint32_t v)
+{
+    return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+}
+
+static uint32_t read_u32(const char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return is_little_endian() ? v : swap32(v);
+}
+
+// n little-endian doubles at p: used in place on little-endian hosts,
+// byte-swapped into buf otherwise
+static const double *read_doubles(const char *p, int n, double *buf)
+{
+    if (is_little_endian())
+        return (const double *)p;
+
+    for (int i = 0; i < n; i++)
+    {
+        uint64_t v;
+        memcpy(&v, p + 8 * i, 8);
+        v = ((uint64_t)swap32(v) << 32) | swap32(v >> 32);
+        memcpy(&buf[i], &v, 8);
+    }
+    return buf;
+}
+
+static bool is_binary(const char *data, size_t size)
+{
+    return size >= sizeof(binary_magic) && memcmp(data, binary_magic, sizeof(binary_magic)) == 0;
+}
+
+static bool load_binary(nifs3_pool_t *pool, const char *data, size_t size)
+{
+    if (size < 16 || read_u32(data + 8) != BINARY_VERSION)
+    {
+        printf("Unsupported binary file version\n");
+        return false;
+    }
+
+    uint32_t count = read_u32(data + 12);
+    const char *counts = data + 16;
+    const char *p = counts + 8 * (size_t)count;
+    if (count > (size - 16) / 8)
+    {
+        printf("Invalid file format (truncated)\n");
+        return false;
+    }
+
+    double *buf = NULL;
+    int buf_cap = 0;
+
+    for (uint32_t k = 0; k < count; k++)
+    {
+        uint32_t n = read_u32(counts + 8 * k);
+        uint32_t nu = read_u32(counts + 8 * k + 4);
+        size_t bytes = 8 * (3 * (size_t)n + nu);
+
+        if (n == 0 || nu == 0 || n > INT32_MAX / 3 || nu > INT32_MAX || bytes > (size_t)(data + size - p))
+        {
+            printf("Invalid file format (%u %u)\n", n, nu);
+            free(buf);
+            return false;
+        }
+
+        if (!is_little_endian() && (int)(3 * n + nu) > buf_cap)
+        {
+            buf_cap = 3 * n + nu;
+            buf = realloc(buf, sizeof(double) * buf_cap);
+        }
+
+        const double *x = read_doubles(p, n, buf);
+        const double *y = read_doubles(p + 8 * n, n, buf + n);
+        const double *t = read_doubles(p + 16 * n, n, buf + 2 * n);
+        const double *u = read_doubles(p + 24 * n, nu, buf + 3 * n);
+
+        int i = create_nifs3_2d(pool, x, y, t, n);
+        set_nifs3_2d_interpolation_pts(pool, i, u, nu);
+        p += bytes;
+    }
+
+    free(buf);
+    return true;
+}
+
+static void write_u32(FILE *fh, uint32_t v)
+{
+    v = is_little_endian() ? v : swap32(v);
+    fwrite(&v, sizeof(v), 1, fh);
+}
+
+static void write_doubles(FILE *fh, const double *v, int n)
+{
+    if (is_little_endian())
+    {
+        fwrite(v, sizeof(double), n, fh);
+        return;
+    }
+
+    double swapped;
+    for (int i = 0; i < n; i++)
+        fwrite(read_doubles((const char *)&v[i], 1, &swapped), sizeof(double), 1, fh);
+}
+
+static void save_binary(const nifs3_pool_t *pool, FILE *fh, const int *order, int count)
+{
+    fwrite(binary_magic, 1, sizeof(binary_magic), fh);
+    write_u32(fh, BINARY_VERSION);
+    write_u32(fh, count);
+
+    for (int k = 0; k < count; k++)
+    {
+        write_u32(fh, pool->interp[order[k]].iX->n);
+        write_u32(fh, pool->interp[order[k]].n);
+    }
+
+    for (int k = 0; k < count; k++)
+    {
+        nifs3_2d_t *c = &pool->interp[order[k]];
+        write_doubles(fh, c->iX->y, c->iX->n); // Xs
+        write_doubles(fh, c->iY->y, c->iY->n); // Ys
+        write_doubles(fh, c->iX->x, c->iX->n); // Ts
+        write_doubles(fh, c->u, c->n);         // Us
+    }
+}
+
+static void save_text(const nifs3_pool_t *pool, FILE *fh, const int *order, int count)
+{
+    for (int k = 0; k < count; k++)
+    {
+        int i = order[k];
+
+        for (int j = 0; j < pool->interp[i].iX->n; j++)
+            fprintf(fh, "%lf ", pool->interp[i].iX->y[j]); // Xs
+        fprintf(fh, "\n");
+
+        for (int j = 0; j < pool->interp[i].iY->n; j++)
+            fprintf(fh, "%lf ", pool->interp[i].iY->y[j]); // Ys
+        fprintf(fh, "\n");
+
+        for (int j = 0; j < pool->interp[i].iX->n; j++)
+            fprintf(fh, "%lf ", pool->interp[i].iX->x[j]); // Ts
+        fprintf(fh, "\n");
+
+        for (int j = 0; j < pool->interp[i].n; j++)
+            fprintf(fh, "%lf ", pool->interp[i].u[j]); // Us
+        fprintf(fh, "\n");
+
+        fprintf(fh, "\n");
+    }
+}
+
+///////////// Loading and saving //////////////
+bool load_from_file(nifs3_pool_t *pool, const char *path)
+{
+    cleanup_nifs3_2d(pool);
+
+    size_t size;
+    const char *data = map_file(path, &size);
+    if (data == MAP_FAILED)
+    {
+        printf("Failed to open file %s\n", path);
+        return false;
+    }
+
+    bool ok = is_binary(data, size) ? load_binary(pool, data, size) : load_text(pool, data, size);
+
+    if (data != NULL)
+        munmap((void *)data, size);
+    return ok;
+}
+
+bool is_binary_path(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+    return ext != NULL && strcmp(ext, BINARY_EXTENSION) == 0;
+}
+
+static int compare_int(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+bool save_to_file(const nifs3_pool_t *pool, const char *path)
+{
+    bool binary = is_binary_path(path);
+
+    FILE *fh = fopen(path, binary ? "wb" : "w");
+    if (fh == NULL)
+    {
+        printf("Failed to open file %s\n", path);
+        return false;
+    }
+
+    // in handle order, which for a loaded file is the file order
+    // live is NULL in an empty pool, and memcpy must not get NULL
+    int *order = malloc(sizeof(int) * max(pool->count, 1));
+    if (pool->count > 0)
+    {
+        memcpy(order, pool->live, sizeof(int) * pool->count);
+        qsort(order, pool->count, sizeof(int), compare_int);
+    }
+
+    if (binary)
+        save_binary(pool, fh, order, pool->count);
+    else
+        save_text(pool, fh, order, pool->count);
+
+    free(order);
+
+    bool ok = !ferror(fh);
+    ok &= fclose(fh) == 0;
+    if (!ok)
+        printf("Failed to write file %s\n", path);
+    return ok;
+}
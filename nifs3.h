@@ -0,0 +1,228 @@
+#ifndef NIFS3_H
+#define NIFS3_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "aabb_tree.h"
+
+/////////// Linspace //////////////
+void linspace(double start, double end, int n, double *data);
+double *alloc_linspace(double start, double end, int n);
+
+//////////// Natural cubic spline interpolation //////////////
+// The knot-dependent half of the forward elimination of the natural spline
+// system: row factors and inverse pivots. It only depends on the knots, so
+// the splines of x(t) and y(t) of a curve share one.
+typedef struct
+{
+    double *lam;
+    double *ip;
+    int cap;
+    int refs; // splines using it
+} nifs3_elim_t;
+
+typedef struct
+{
+    // x, y, M, z and c are parts of one allocation, x first
+    double *x;
+    double *y;
+    double *M;
+    double *c; // per-interval power-basis coefficients (a, b, c, d), or NULL
+
+    // forward elimination state of the natural spline system, kept so that
+    // appends only redo the rows they touch: the shared row factors and the
+    // eliminated right-hand side
+    nifs3_elim_t *elim;
+    double *z;
+
+    int n;
+    int cap; // allocated knots
+} nifs3_t;
+
+// coeffs: also precompute the power-basis form of every interval, so that
+// evaluation is a single Horner step
+nifs3_t *nifs3_init(const double *x, const double *y, int n, bool coeffs);
+// builds the splines of x(t) and y(t), factoring the knot-dependent part of
+// the system once for both; they share it from then on, so they must be
+// edited together (the same appends, the same knot scaling)
+void nifs3_init_2d(const double *t, const double *x, const double *y, int n, bool coeffs,
+                   nifs3_t **iX, nifs3_t **iY);
+nifs3_t *nifs3_copy(const nifs3_t *interp);
+void nifs3_free(nifs3_t *interp);
+
+// grows the storage to at least cap knots
+void nifs3_reserve(nifs3_t *interp, int cap);
+// appends the node (x, y), x past the last knot: amortized O(1) storage
+// growth, one new row of elimination, and a back substitution that stops as
+// soon as the previous solution is reproduced. Returns the first knot
+// interval whose cubic changed; all the ones after it did too. Returns -1
+// and leaves interp as is if x is not past the last knot.
+int nifs3_append(nifs3_t *interp, double x, double y);
+// changes the value at knot k; only the rows the change actually reaches
+// are re-eliminated and back-substituted. Returns the first knot interval
+// whose cubic changed and stores the last one in *last; -1 if there is no
+// knot k.
+int nifs3_set_value(nifs3_t *interp, int k, double y, int *last);
+// multiplies every knot by a > 0 without re-solving the system
+void nifs3_scale_knots(nifs3_t *interp, double a);
+
+// index i in [1, n - 1] of the knot interval [x[i - 1], x[i]) containing x
+// (clamped to the first/last interval), found by binary search
+int nifs3_find_interval(const nifs3_t *interp, double x);
+double nifs3_get(const nifs3_t *interp, double x);
+// evaluates the spline at m non-decreasing points, carrying the interval
+// cursor forward: O(n + m) for a full sweep
+void nifs3_eval_sorted(const nifs3_t *interp, const double *u, int m, double *out);
+// exact range of the spline's values over knot interval k, [x[k - 1], x[k]],
+// and over all of it: the overshoot of the cubics between the knots included
+void nifs3_interval_range(const nifs3_t *interp, int k, double *lo, double *hi);
+void nifs3_range(const nifs3_t *interp, double *lo, double *hi);
+
+///////////// 2D Interpolation //////////////
+typedef struct
+{
+    nifs3_t *iX, *iY;
+    double xMax, xMin, yMax, yMin; // of the whole curve, kept up to date
+
+    int n;
+    double *u; // interpolation points
+
+    // changes whenever the nodes, the splines or u change, never repeats
+    // across the interpolators of a pool; 0 for a free slot
+    unsigned version;
+
+    int live_index; // position in live
+    int next_free;  // free list link of a free slot
+    int proxy;      // leaf in the bounding box tree, -1 while the box is empty
+
+    // exact boxes of the knot intervals in a complete binary tree (root at
+    // 1, interval k at bounds_leaves + k - 1), so an edit refits the curve's
+    // box in the intervals it changed plus log n
+    aabb_t *bounds;
+    int bounds_leaves;
+} nifs3_2d_t;
+
+// Growable pool of 2D interpolators indexed by handle. A handle stays valid
+// until its interpolator is freed; freed slots are recycled through a free
+// list. live[0..count) holds the live handles, so loops over the curves
+// never visit free slots (freeing moves the last live handle into the gap).
+// Pools are independent of each other: every *_nifs3_2d function takes the
+// one it works on, and functions taking a const pool only read it.
+typedef struct
+{
+    nifs3_2d_t *interp;
+    int cap;
+    int *live;
+    int count;
+
+    int free_head; // first free slot, the rest are chained through next_free
+    // leaves are the bounding boxes of the live interpolators with a
+    // non-empty box, see query_nifs3_2d
+    aabb_tree_t tree;
+    unsigned last_version;
+} nifs3_pool_t;
+
+// an empty pool; cleanup_nifs3_2d frees a pool and leaves it empty again
+#define NIFS3_POOL_INIT {NULL, 0, NULL, 0, -1, AABB_TREE_INIT, 0}
+
+bool is_live_nifs3_2d(const nifs3_pool_t *pool, int i);
+// calls fn(ctx, i) for every interpolator whose bounding box overlaps the
+// rectangle, until fn returns false; a dynamic AABB tree over the boxes,
+// kept up to date by every change, makes it sub-linear in the curve count
+void query_nifs3_2d(const nifs3_pool_t *pool, double xMin, double xMax, double yMin, double yMax, bool (*fn)(void *ctx, int i), void *ctx);
+// Squared distance from (x, y) to interpolator i and, in *t, the parameter of
+// its closest point: exact per knot interval, from the roots of the quintic
+// derivative of the squared distance. Intervals whose bounding box is no
+// closer than bound are skipped; returns bound (leaving *t) if none is.
+double nearest_point_nifs3_2d(const nifs3_pool_t *pool, int i, double x, double y, double bound, double *t);
+// the interpolator closest to (x, y) within distance r, -1 if none; *t (if
+// not NULL) gets the parameter of its closest point
+int nearest_nifs3_2d(const nifs3_pool_t *pool, double x, double y, double r, double *t);
+void free_nifs3_2d(nifs3_pool_t *pool, int i);
+void cleanup_nifs3_2d(nifs3_pool_t *pool);
+void set_nifs3_2d_interpolation_pts(nifs3_pool_t *pool, int i, const double *u, int n);
+int create_nifs3_2d(nifs3_pool_t *pool, const double *x, const double *y, const double *t, int n);
+// appends node (x, y) to interpolator i, respacing its knots evenly over
+// [0, 1]; incremental when they already are, a rebuild otherwise
+void add_node_nifs3_2d(nifs3_pool_t *pool, int i, double x, double y);
+// moves node k of interpolator i to (x, y), keeping its parameter
+void set_node_nifs3_2d(nifs3_pool_t *pool, int i, int k, double x, double y);
+// evaluates iX and iY of interpolator i at m non-decreasing points in one pass
+void eval_nifs3_2d_sorted(const nifs3_pool_t *pool, int i, const double *u, int m, double *x, double *y);
+
+// instruction set used by eval_nifs3_2d_block, picked at runtime
+typedef enum
+{
+    NIFS3_ISA_SCALAR,
+    NIFS3_ISA_SSE2,
+    NIFS3_ISA_AVX2
+} nifs3_isa_t;
+
+// best instruction set this CPU supports
+nifs3_isa_t nifs3_isa_supported();
+// forces a path (clamped to what the CPU supports), returns the one selected
+nifs3_isa_t nifs3_set_isa(nifs3_isa_t isa);
+
+// evaluates interpolator i at m non-decreasing points with the widest SIMD
+// path available, writing interleaved x/y pairs to xy (2 * m doubles)
+void eval_nifs3_2d_block(const nifs3_pool_t *pool, int i, const double *u, int m, double *xy);
+
+// Parameters of a polyline within tol of interpolator i, found in one pass
+// with no trial evaluation: knot interval k of length h is cut into
+// ceil(h sqrt(B / (8 tol))) equal pieces, where B bounds |C''| on it by the
+// second derivatives at its knots (at most TESSELLATE_MAX_PIECES). Returns
+// their number and stores them, allocated with malloc, in *u.
+#define TESSELLATE_MAX_PIECES 4096
+
+int tessellate_nifs3_2d(const nifs3_pool_t *pool, int i, double tol, double **u);
+
+///////////// Optimizing interpolation points //////////////
+// chord error of the samples Douglas-Peucker picks from, as a fraction of
+// its epsilon
+#define OPTIMIZE_TOLERANCE 0.25
+
+// Douglas-Peucker over n interleaved points xy: sets keep[j] for the points
+// the polyline within epsilon of all of them goes through, and returns their
+// number. Iterative and allocation-free; stack is work space for 2 * n ints.
+int douglas_prucker(const double *xy, int n, double epsilon, bool *keep, int *stack);
+
+// Interpolation points for interpolator i: the curve is sampled adaptively,
+// densely only where it bends, to within OPTIMIZE_TOLERANCE * epsilon of
+// its chords, and Douglas-Peucker keeps the fewest samples whose polyline
+// stays within (1 - OPTIMIZE_TOLERANCE) * epsilon of them, so that it is
+// within epsilon of the curve. Returns their number and stores them,
+// allocated with malloc, in *u.
+int simplify_nifs3_2d(const nifs3_pool_t *pool, int i, double epsilon, double **u);
+void optimize_nifs3_2d(nifs3_pool_t *pool, int i, double epsilon);
+// optimize_nifs3_2d for every live interpolator, on parallel_for workers;
+// the new points are set together once all curves are done
+void optimize_all_nifs3_2d(nifs3_pool_t *pool, double epsilon);
+
+// optimize_nifs3_2d for the given interpolators on a background thread
+// (itself using parallel_for). Finishing sets the new points of every curve
+// that has not changed since the start, unless the job was cancelled, and
+// returns how many were set; it waits for the job if it is still running.
+// The pool must outlive the job, and is only touched by start and finish.
+typedef struct optimize_job optimize_job_t;
+
+optimize_job_t *start_optimize_job(nifs3_pool_t *pool, const int *handles, int count, double epsilon);
+// curves finished so far, out of *total
+int optimize_job_progress(const optimize_job_t *job, int *total);
+bool optimize_job_done(const optimize_job_t *job);
+// stops the job within a knot interval of every curve in progress, so a
+// finish right after it does not wait for a long curve to complete
+void cancel_optimize_job(optimize_job_t *job);
+int finish_optimize_job(optimize_job_t *job);
+
+///////////// Loading 2d interpolators from file //////////////
+// Text .data files and the binary format (see nifs3.c) are told apart by
+// the magic number on load and by the extension on save.
+#define BINARY_EXTENSION ".nifs3"
+
+bool is_binary_path(const char *path);
+// replaces the curves of pool by the file's
+bool load_from_file(nifs3_pool_t *pool, const char *path);
+bool save_to_file(const nifs3_pool_t *pool, const char *path);
+
+#endif
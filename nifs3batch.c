@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nifs3.h"
+#include "parallel.h"
+#include "bench_util.h"
+
+// Headless counterpart of the editor for batch pipelines: loads a file,
+// optionally optimizes every curve, saves the result in the format the
+// output's extension picks and writes evenly spaced samples of every
+// curve as CSV. No window, no GL.
+
+void usage()
+{
+    printf("usage: nifs3batch [-e epsilon] [-j threads] [-s samples file] input [output]\n"
+           "  -e epsilon       optimize the interpolation points of every curve\n"
+           "  -j threads       worker threads (default: NIFS3_THREADS or one per core)\n"
+           "  -s samples file  evaluate every curve at samples evenly spaced parameters\n"
+           "                   and write curve,t,x,y lines to file\n"
+           "  output           saved as binary if it ends in " BINARY_EXTENSION ", as text otherwise\n");
+}
+
+int count_points(const nifs3_pool_t *curves)
+{
+    int points = 0;
+    for (int k = 0; k < curves->count; k++)
+        points += curves->interp[curves->live[k]].n;
+    return points;
+}
+
+// samples points of every curve, evenly spaced over its parameter range
+// and evaluated with eval_nifs3_2d_block, one curve,t,x,y line each
+bool save_samples(const nifs3_pool_t *curves, int samples, const char *path)
+{
+    FILE *fh = fopen(path, "w");
+    if (fh == NULL)
+    {
+        printf("Failed to open file %s\n", path);
+        return false;
+    }
+
+    double *u = malloc(sizeof(double) * samples);
+    double *xy = malloc(sizeof(double) * 2 * samples);
+    fprintf(fh, "curve,t,x,y\n");
+    for (int k = 0; k < curves->count; k++)
+    {
+        const nifs3_t *iX = curves->interp[curves->live[k]].iX;
+        double t0 = iX->x[0], t1 = iX->x[iX->n - 1];
+        for (int j = 0; j < samples; j++)
+            u[j] = t0 + (t1 - t0) * j / (samples - 1);
+        eval_nifs3_2d_block(curves, curves->live[k], u, samples, xy);
+        for (int j = 0; j < samples; j++)
+            fprintf(fh, "%d,%.17g,%.17g,%.17g\n", k, u[j], xy[2 * j], xy[2 * j + 1]);
+    }
+    free(u);
+    free(xy);
+
+    bool ok = !ferror(fh);
+    ok = fclose(fh) == 0 && ok;
+    if (!ok)
+        printf("Failed to write file %s\n", path);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    double epsilon = 0;
+    bool optimize = false;
+    int samples = 0;
+    const char *input = NULL, *output = NULL, *samples_path = NULL;
+    nifs3_pool_t curves = NIFS3_POOL_INIT;
+
+    for (int a = 1; a < argc; a++)
+    {
+        char *end;
+        if (strcmp(argv[a], "-e") == 0 && a + 1 < argc)
+        {
+            epsilon = strtod(argv[++a], &end);
+            optimize = true;
+            if (*end != '\0' || !(epsilon > 0))
+            {
+                printf("Invalid epsilon: %s\n", argv[a]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[a], "-j") == 0 && a + 1 < argc)
+        {
+            int threads = strtol(argv[++a], &end, 10);
+            if (*end != '\0' || threads < 1)
+            {
+                printf("Invalid thread count: %s\n", argv[a]);
+                return 1;
+            }
+            parallel_set_threads(threads);
+        }
+        else if (strcmp(argv[a], "-s") == 0 && a + 2 < argc)
+        {
+            samples = strtol(argv[++a], &end, 10);
+            if (*end != '\0' || samples < 2)
+            {
+                printf("Invalid sample count: %s\n", argv[a]);
+                return 1;
+            }
+            samples_path = argv[++a];
+        }
+        else if (argv[a][0] == '-' || output != NULL)
+        {
+            usage();
+            return 1;
+        }
+        else if (input == NULL)
+            input = argv[a];
+        else
+            output = argv[a];
+    }
+
+    if (input == NULL)
+    {
+        usage();
+        return 1;
+    }
+
+    double start = now();
+    if (!load_from_file(&curves, input))
+    {
+        cleanup_nifs3_2d(&curves);
+        return 1;
+    }
+    int points = count_points(&curves);
+    printf("loaded %s: %d curves, %d interpolation points (%.3f s)\n",
+           input, curves.count, points, now() - start);
+
+    if (optimize)
+    {
+        start = now();
+        optimize_all_nifs3_2d(&curves, epsilon);
+        printf("optimized with epsilon %g: %d -> %d interpolation points (%.3f s)\n",
+               epsilon, points, count_points(&curves), now() - start);
+    }
+
+    if (output != NULL)
+    {
+        start = now();
+        if (!save_to_file(&curves, output))
+        {
+            cleanup_nifs3_2d(&curves);
+            return 1;
+        }
+        printf("saved %s (%.3f s)\n", output, now() - start);
+    }
+
+    if (samples_path != NULL)
+    {
+        start = now();
+        if (!save_samples(&curves, samples, samples_path))
+        {
+            cleanup_nifs3_2d(&curves);
+            return 1;
+        }
+        printf("sampled %d points per curve to %s (%.3f s)\n", samples, samples_path, now() - start);
+    }
+
+    cleanup_nifs3_2d(&curves);
+    return 0;
+}
@@ -5,7 +5,11 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <time.h>
 
+#include "nifs3.h"
+
+#define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
 #include <GL/glut.h>
 
@@ -15,356 +19,127 @@
 #define min(a, b) ((a) < (b) ? (a) : (b))
 #define max(a, b) ((b) < (a) ? (a) : (b))
 
-/////////// Linspace //////////////
-void linspace(double start, double end, int n, double *data)
-{
-    double step = (end - start) / (n - 1);
-    for (int i = 0; i < n; i++)
-        data[i] = start + i * step;
-}
+// the curves being edited
+nifs3_pool_t curves = NIFS3_POOL_INIT;
 
-double *alloc_linspace(double start, double end, int n)
+void cleanup()
 {
-    double *data = malloc(sizeof(double) * n);
-    linspace(start, end, n, data);
-    return data;
+    cleanup_nifs3_2d(&curves);
 }
 
-//////////// Natural cubic spline interpolation //////////////
-double *get_diff_polys(const double *x, const double *y, int n)
+///////////// 2D drawing //////////////
+// A polyline of an interpolator in a vertex buffer, rebuilt only when the
+// interpolator's version changes
+typedef struct
 {
-    double *y2 = malloc(sizeof(double) * (n - 1));
-    for (int i = 0; i < n - 1; i++)
-    {
-        y2[i] = (y[i] - y[i + 1]) / (x[i + 1] - x[i]);
-    }
+    GLuint vbo;
+    int count;
+    unsigned version;
+    int level; // LOD level it was tessellated for
+} curve_vbo_t;
 
-    double *y3 = malloc(sizeof(double) * (n - 2));
-    for (int i = 0; i < n - 2; i++)
-    {
-        y3[i] = (y2[i] - y2[i + 1]) / (x[i + 2] - x[i]);
-    }
-
-    free(y2);
-    return y3;
-}
+// Zoom levels are powers of two of units per pixel: at level L the curve is
+// tessellated to within 2^L / 2 units, half a pixel or less on screen. The
+// last LOD_CACHE_LEVELS levels stay cached, so zooming back and forth
+// reuses them and panning never tessellates.
+#define LOD_CACHE_LEVELS 4
 
 typedef struct
 {
-    double *x;
-    double *y;
-    double *M;
-    int n;
-} nifs3_t;
-
-nifs3_t *nifs3_init(const double *x, const double *y, int n)
-{
-    assert(n >= 0);
-    nifs3_t *interp = malloc(sizeof(nifs3_t));
-
-    double *M = malloc(sizeof(double) * (n + 1));
-
-    interp->x = malloc(max(sizeof(double) * n, 1));
-    interp->y = malloc(max(sizeof(double) * n, 1));
-    interp->M = M;
-    interp->n = n;
-
-    if (n != 0)
-    {
-        memcpy(interp->x, x, sizeof(double) * n);
-        memcpy(interp->y, y, sizeof(double) * n);
-    }
-
-    if (n <= 2)
-    {
-        for (int i = 0; i <= n; i++)
-            M[i] = 0;
-        return interp;
-    }
-
-    double *q = malloc(sizeof(double) * n);
-    double *u = malloc(sizeof(double) * n);
-
-    double *d = get_diff_polys(x, y, n);
-    for (int i = 0; i < n - 2; i++)
-        d[i] *= 6;
-
-    q[0] = u[0] = 0;
-
-    for (int i = 1; i <= n - 1; i++)
-    {
-        double h_i = x[i] - x[i - 1];
-        double h_i1 = x[i + 1] - x[i];
-        double lam = h_i / (h_i + h_i1);
+    curve_vbo_t samples; // through the interpolation points u
+    curve_vbo_t lod[LOD_CACHE_LEVELS]; // indexed by level modulo LOD_CACHE_LEVELS
+} curve_cache_t;
 
-        double p = lam * q[i - 1] + 2;
-        q[i] = (lam - 1) / p;
-        u[i] = (d[i - 1] - lam * u[i - 1]) / p;
-    }
-
-    M[0] = M[n] = 0;
-    M[n - 1] = u[n - 1];
-
-    for (int i = n - 2; i > 0; i--)
-        M[i] = u[i] + q[i] * M[i + 1];
-
-    free(u);
-    free(q);
-    free(d);
+// grows with the interpolator pool, indexed by handle
+curve_cache_t *curve_cache;
+int curve_cache_cap;
 
-    return interp;
-}
-
-void nifs3_free(nifs3_t *interp)
+// evaluates interpolator inp at u[0..n) into the buffer
+void upload_curve(curve_vbo_t *v, int inp, const double *u, int n)
 {
-    if (interp == NULL)
-        return;
-    free(interp->x);
-    free(interp->y);
-    free(interp->M);
-    free(interp);
-}
-
-double nifs3_get(nifs3_t *interp, double x)
-{
-    if (interp->n == 0)
-        return 0;
-
-    if (x < interp->x[0] || x > interp->x[interp->n - 1] * 1.0001)
-    {
-        printf("x out of range (%g)\n", x);
-        return 0;
-    }
+    double *xy = malloc(sizeof(double) * 2 * max(n, 1));
+    float *vertices = malloc(sizeof(float) * 2 * max(n, 1));
 
-    int i = 1;
-    while (i < interp->n && x >= interp->x[i])
-        i++;
+    eval_nifs3_2d_block(&curves, inp, u, n, xy);
+    for (int i = 0; i < 2 * n; i++)
+        vertices[i] = xy[i];
 
-    i = min(max(1, i), interp->n - 1);
+    if (v->vbo == 0)
+        glGenBuffers(1, &v->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, v->vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 2 * n, vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-    double h = interp->x[i] - interp->x[i - 1];
-    double t1 = interp->x[i] - x;
-    double t2 = x - interp->x[i - 1];
+    v->count = n;
+    v->version = curves.interp[inp].version;
 
-    return (1 / h) * (interp->M[i - 1] / 6 * t1 * t1 * t1 +
-                      interp->M[i] / 6 * t2 * t2 * t2 +
-                      (interp->y[i - 1] - interp->M[i - 1] / 6 * h * h) * t1 +
-                      (interp->y[i] - interp->M[i] / 6 * h * h) * t2);
+    free(vertices);
+    free(xy);
 }
 
-///////////// 2D Interpolation //////////////
-typedef struct
-{
-    nifs3_t *iX, *iY;
-    double xMax, xMin, yMax, yMin;
-
-    int n;
-    double *u; // interpolation points
-} nifs3_2d_t;
-
-#define MAX_INTERPOLATORS 128
-nifs3_2d_t interp[MAX_INTERPOLATORS];
-
-void draw_nifs3_2d(int inp)
+curve_cache_t *get_curve_cache(int inp)
 {
-    for (int i = 0; i < interp[inp].n; i++)
+    if (inp >= curve_cache_cap)
     {
-        double x = nifs3_get(interp[inp].iX, interp[inp].u[i]);
-        double y = nifs3_get(interp[inp].iY, interp[inp].u[i]);
-        glVertex2d(x, y);
+        curve_cache = realloc(curve_cache, sizeof(curve_cache_t) * curves.cap);
+        memset(&curve_cache[curve_cache_cap], 0, sizeof(curve_cache_t) * (curves.cap - curve_cache_cap));
+        curve_cache_cap = curves.cap;
     }
+    return &curve_cache[inp];
 }
 
-void free_nifs3_2d(int i)
-{
-    nifs3_free(interp[i].iX);
-    nifs3_free(interp[i].iY);
-    free(interp[i].u);
-    memset(&interp[i], 0, sizeof(nifs3_2d_t));
-}
-
-void cleanup_nifs3_2d()
-{
-    for (int i = 0; i < MAX_INTERPOLATORS; i++)
-        free_nifs3_2d(i);
-}
-
-void set_nifs3_2d_interpolation_pts(int i, const double *u, int n)
+// deletes the buffers of handle inp, before its interpolator is freed (the
+// slot may be reused by a curve whose versions start over)
+void free_curve_cache(int inp)
 {
-    assert(interp[i].iX != NULL);
-    interp[i].n = n;
-    free(interp[i].u);
-    interp[i].u = malloc(sizeof(double) * n);
-    memcpy(interp[i].u, u, sizeof(double) * n);
-}
-
-int create_nifs3_2d(const double *x, const double *y, const double *t, int n)
-{
-    for (int i = 0; i < MAX_INTERPOLATORS; i++)
-    {
-        if (interp[i].iX != NULL)
-            continue;
-
-        interp[i].iX = nifs3_init(t, x, n);
-        interp[i].iY = nifs3_init(t, y, n);
-
-        interp[i].xMin = INFINITY;
-        interp[i].xMax = -INFINITY;
-        interp[i].yMin = INFINITY;
-        interp[i].yMax = -INFINITY;
-
-        for (int j = 0; j < n; j++)
-        {
-            interp[i].xMin = min(interp[i].xMin, x[j]);
-            interp[i].xMax = max(interp[i].xMax, x[j]);
-            interp[i].yMin = min(interp[i].yMin, y[j]);
-            interp[i].yMax = max(interp[i].yMax, y[j]);
-        }
-
-        set_nifs3_2d_interpolation_pts(i, t, n);
-
-        return i;
-    }
+    if (inp >= curve_cache_cap)
+        return;
 
-    assert(false && "No free 2d interpolators");
-    return -1;
+    curve_cache_t *c = &curve_cache[inp];
+    glDeleteBuffers(1, &c->samples.vbo);
+    for (int l = 0; l < LOD_CACHE_LEVELS; l++)
+        glDeleteBuffers(1, &c->lod[l].vbo);
+    memset(c, 0, sizeof(curve_cache_t));
 }
 
-// assumes that interpolation nodes are in linspace
-void add_node_nifs3_2d(int i, double x, double y)
+// free_curve_cache for every handle, before the whole pool goes
+void free_curve_caches()
 {
-    if (interp[i].iX == NULL)
-        return;
-
-    int n = interp[i].iX->n;
-    double *x_ = interp[i].iX->y;
-    double *y_ = interp[i].iY->y;
-
-    double *t = alloc_linspace(0, 1, n + 1);
-    double *px = malloc(sizeof(double) * (n + 1));
-    double *py = malloc(sizeof(double) * (n + 1));
-    memcpy(px, x_, sizeof(double) * n);
-    memcpy(py, y_, sizeof(double) * n);
-    px[n] = x;
-    py[n] = y;
-
-    nifs3_free(interp[i].iX);
-    nifs3_free(interp[i].iY);
-    interp[i].iX = nifs3_init(t, px, n + 1);
-    interp[i].iY = nifs3_init(t, py, n + 1);
-    free(t);
-    free(px);
-    free(py);
-
-    double *u = alloc_linspace(0, 1, 10 * (n + 1));
-    set_nifs3_2d_interpolation_pts(i, u, 10 * (n + 1));
-    free(u);
+    for (int i = 0; i < curve_cache_cap; i++)
+        free_curve_cache(i);
 }
 
-///////////// Loading 2d interpolators from file //////////////
-double *get_line_array(FILE *fh, int *count)
+// polyline through the interpolation points of inp
+curve_vbo_t *curve_samples(int inp)
 {
-    int real_count = 0;
-    int capacity = 32;
-    double *arr = malloc(sizeof(double) * capacity);
-
-    while (fscanf(fh, "%lf", &arr[real_count]) > 0)
-    {
-        real_count++;
-
-        int c;
-        while (isspace(c = fgetc(fh)) && c != '\n' && c != EOF)
-        {
-        }
-
-        if (c == '\n' || c == EOF)
-            break;
-
-        ungetc(c, fh);
-
-        if (real_count >= capacity)
-        {
-            capacity *= 2;
-            arr = realloc(arr, sizeof(double) * capacity);
-        }
-    }
-
-    arr = realloc(arr, sizeof(double) * real_count);
-    *count = real_count;
-    return arr;
+    curve_vbo_t *v = &get_curve_cache(inp)->samples;
+    if (v->vbo == 0 || v->version != curves.interp[inp].version)
+        upload_curve(v, inp, curves.interp[inp].u, curves.interp[inp].n);
+    return v;
 }
 
-bool load_from_file(const char *path)
+// polyline of inp tessellated for LOD level
+curve_vbo_t *curve_lod(int inp, int level)
 {
-    cleanup_nifs3_2d();
-
-    FILE *fh = fopen(path, "r");
-    if (fh == NULL)
-    {
-        printf("Failed to open file %s\n", path);
-        return false;
-    }
+    int slot = ((level % LOD_CACHE_LEVELS) + LOD_CACHE_LEVELS) % LOD_CACHE_LEVELS;
+    curve_vbo_t *v = &get_curve_cache(inp)->lod[slot];
 
-    while (!feof(fh))
+    if (v->vbo == 0 || v->version != curves.interp[inp].version || v->level != level)
     {
-        int nx, ny, nt, nu;
-        double *x = get_line_array(fh, &nx);
-        double *y = get_line_array(fh, &ny);
-        double *t = get_line_array(fh, &nt);
-        double *u = get_line_array(fh, &nu);
-
-        if (nx == 0 && ny == 0 && nt == 0 && nu == 0)
-            break;
-
-        if (nx != nt || ny != nt || nt == 0 || nu == 0)
-        {
-            printf("Invalid file format (%d %d %d %d)\n", nx, ny, nt, nu);
-            return false;
-        }
-
-        int i = create_nifs3_2d(x, y, t, nt);
-        set_nifs3_2d_interpolation_pts(i, u, nu);
-        free(x);
-        free(y);
-        free(t);
+        double *u;
+        int n = tessellate_nifs3_2d(&curves, inp, ldexp(0.5, level), &u);
+        upload_curve(v, inp, u, n);
+        v->level = level;
         free(u);
     }
-
-    return true;
+    return v;
 }
 
-void save_to_file(const char *path)
+// binds the buffer as the vertex array
+void bind_curve_vbo(const curve_vbo_t *v)
 {
-    FILE *fh = fopen(path, "w");
-    if (fh == NULL)
-    {
-        printf("Failed to open file %s\n", path);
-        return;
-    }
-
-    for (int i = 0; i < MAX_INTERPOLATORS; i++)
-    {
-        if (interp[i].iX == NULL)
-            continue;
-
-        for (int j = 0; j < interp[i].iX->n; j++)
-            fprintf(fh, "%lf ", interp[i].iX->y[j]); // Xs
-        fprintf(fh, "\n");
-
-        for (int j = 0; j < interp[i].iY->n; j++)
-            fprintf(fh, "%lf ", interp[i].iY->y[j]); // Ys
-        fprintf(fh, "\n");
-
-        for (int j = 0; j < interp[i].iX->n; j++)
-            fprintf(fh, "%lf ", interp[i].iX->x[j]); // Ts
-        fprintf(fh, "\n");
-
-        for (int j = 0; j < interp[i].n; j++)
-            fprintf(fh, "%lf ", interp[i].u[j]); // Us
-        fprintf(fh, "\n");
-
-        fprintf(fh, "\n");
-    }
+    glBindBuffer(GL_ARRAY_BUFFER, v->vbo);
+    glVertexPointer(2, GL_FLOAT, 0, NULL);
 }
 
 ///////////// APPLICATION //////////////
@@ -421,11 +196,18 @@ struct scene_data_t
     bool dragging;
     int lastX, lastY;
 
+    // control node under the mouse while dragging, -1 when panning
+    int drag_interpolator_i, drag_node;
+
     double xMin, xMax, yMin, yMax;
 
     bool showImage;
     int imageW, imageH;
-    int texture;
+
+    // line strips follow the curve at the zoom's level of detail rather
+    // than joining the interpolation points
+    bool lod;
+    GLuint texture;
 
     enum mode mode;
     char text[1024];
@@ -444,9 +226,67 @@ void print_error(const char *fmt, ...)
     va_end(args);
 }
 
+void screen_to_world(int x_, int y_, double *x, double *y)
+{
+    *x = scene_data.xMin + (scene_data.xMax - scene_data.xMin) * ((double)x_ / scene_data.w);
+    *y = scene_data.yMin + (scene_data.yMax - scene_data.yMin) * ((double)(scene_data.h - y_) / scene_data.h);
+}
+
+typedef struct
+{
+    double x, y;
+    double best; // squared distance of the closest node so far
+    int inp, node;
+} node_pick_t;
+
+bool pick_node_in(void *ctx, int i)
+{
+    node_pick_t *pick = ctx;
+    for (int j = 0; j < curves.interp[i].iX->n; j++)
+    {
+        double dx = curves.interp[i].iX->y[j] - pick->x;
+        double dy = curves.interp[i].iY->y[j] - pick->y;
+        if (dx * dx + dy * dy <= pick->best)
+        {
+            pick->best = dx * dx + dy * dy;
+            pick->inp = i;
+            pick->node = j;
+        }
+    }
+    return true;
+}
+
+// control node within a few pixels of the cursor, the closest one wins;
+// only curves whose box is that close are searched
+bool pick_node(int x_, int y_, int *inp, int *node)
+{
+    double x, y;
+    screen_to_world(x_, y_, &x, &y);
+
+    double r = 6 * scene_data.scale;
+    node_pick_t pick = {x, y, r * r, -1, -1};
+    query_nifs3_2d(&curves, x - r, x + r, y - r, y + r, pick_node_in, &pick);
+
+    *inp = pick.inp;
+    *node = pick.node;
+    return *inp != -1;
+}
+
+// selects the curve within a few pixels of the cursor, the closest one;
+// the selection stays when there is none
+void pick_curve(int x_, int y_)
+{
+    double x, y;
+    screen_to_world(x_, y_, &x, &y);
+
+    int i = nearest_nifs3_2d(&curves, x, y, 6 * scene_data.scale, NULL);
+    if (i != -1)
+        scene_data.edit_interpolator_i = i;
+}
+
 void init()
 {
-    bool ok = load_from_file("zadanie7.data");
+    bool ok = load_from_file(&curves, "zadanie7.data");
     if (!ok)
         exit(1);
 
@@ -464,15 +304,14 @@ void init()
     double yMin = INFINITY;
     double yMax = -INFINITY;
 
-    for (int i = 0; i < MAX_INTERPOLATORS; i++)
+    for (int k = 0; k < curves.count; k++)
     {
-        if (interp[i].iX == NULL)
-            continue;
+        int i = curves.live[k];
 
-        xMin = min(xMin, interp[i].xMin);
-        xMax = max(xMax, interp[i].xMax);
-        yMin = min(yMin, interp[i].yMin);
-        yMax = max(yMax, interp[i].yMax);
+        xMin = min(xMin, curves.interp[i].xMin);
+        xMax = max(xMax, curves.interp[i].xMax);
+        yMin = min(yMin, curves.interp[i].yMin);
+        yMax = max(yMax, curves.interp[i].yMax);
     }
 
     scene_data.w = glutGet(GLUT_WINDOW_WIDTH);
@@ -486,6 +325,7 @@ void init()
     scene_data.scale *= 1.1;
 
     scene_data.showImage = false;
+    scene_data.lod = true;
 
     stbi_set_flip_vertically_on_load(true);
 
@@ -511,6 +351,7 @@ void init()
 
     scene_data.mode = MODE_NONE;
     scene_data.edit_interpolator_i = -1;
+    scene_data.drag_interpolator_i = -1;
 }
 
 void mouse(int button, int state, int x, int y)
@@ -519,6 +360,14 @@ void mouse(int button, int state, int x, int y)
     {
         scene_data.dragging = (state == GLUT_DOWN);
 
+        // grabbing a control node drags it instead of panning, clicking
+        // near a curve selects it
+        scene_data.drag_interpolator_i = -1;
+        if (state == GLUT_DOWN && pick_node(x, y, &scene_data.drag_interpolator_i, &scene_data.drag_node))
+            scene_data.edit_interpolator_i = scene_data.drag_interpolator_i;
+        else if (state == GLUT_DOWN)
+            pick_curve(x, y);
+
         scene_data.lastX = x;
         scene_data.lastY = y;
     }
@@ -534,78 +383,105 @@ void mouse(int button, int state, int x, int y)
     glutPostRedisplay();
 }
 
-void timer()
+// The window is only redrawn on input, on data changes and on the edges of
+// the selection blink, so an idle editor with nothing selected uses no CPU.
+#define BLINK_PERIOD_MS 500
+
+bool blink_armed;
+
+void blink()
 {
-    glutPostRedisplay();
-    glutTimerFunc(10, timer, 0);
+    blink_armed = false;
+    if (scene_data.edit_interpolator_i != -1)
+        glutPostRedisplay();
 }
 
-void douglas_prucker(double *x, double *y, int n, double epsilon, bool *keep)
+// arms a one-shot timer for the next blink edge while something is selected
+void schedule_blink(int t)
 {
-    keep[0] = keep[n - 1] = true;
+    if (blink_armed || scene_data.edit_interpolator_i == -1)
+        return;
 
-    double dmax = -1.f;
-    int index = 0;
+    blink_armed = true;
+    glutTimerFunc(BLINK_PERIOD_MS - t % BLINK_PERIOD_MS, blink, 0);
+}
 
-    double dx = x[n - 1] - x[0];
-    double dy = y[n - 1] - y[0];
+// Optimizations run in the background; while one does, a timer polls it
+// to redraw the progress and to apply the result once it is done.
+#define OPTIMIZE_POLL_MS 100
 
-    double dlen = sqrt(dx * dx + dy * dy);
-    dx /= dlen;
-    dy /= dlen;
+optimize_job_t *optimize_job;
+bool optimize_poll_armed;
 
-    for (int i = 1; i < n - 1; i++)
-    {
-        double d = fabs((x[i] - x[0]) * dy - (y[i] - y[0]) * dx);
-        if (d > dmax)
-        {
-            index = i;
-            dmax = d;
-        }
-    }
+void poll_optimize_job();
 
-    if (dmax > epsilon)
-    {
-        douglas_prucker(x, y, index + 1, epsilon, keep);
-        douglas_prucker(x + index, y + index, n - index, epsilon, keep + index);
-    }
+void schedule_optimize_poll()
+{
+    if (optimize_poll_armed || optimize_job == NULL)
+        return;
+
+    optimize_poll_armed = true;
+    glutTimerFunc(OPTIMIZE_POLL_MS, poll_optimize_job, 0);
 }
 
-void optimize_nifs3_2d(int i, double epsilon)
+void poll_optimize_job()
 {
-    nifs3_2d_t *intp = &interp[i];
+    optimize_poll_armed = false;
+    if (optimize_job == NULL)
+        return;
 
-    // Douglas-Peucker algorithm
-    int count = 1024 * 32;
-    double *u = alloc_linspace(intp->iX->x[0], intp->iX->x[intp->iX->n - 1], count);
-    bool *keep = calloc(count, sizeof(bool));
+    if (optimize_job_done(optimize_job))
+    {
+        finish_optimize_job(optimize_job);
+        optimize_job = NULL;
+    }
 
-    double *x = malloc(sizeof(double) * count);
-    double *y = malloc(sizeof(double) * count);
+    schedule_optimize_poll();
+    glutPostRedisplay();
+}
 
-    for (int i = 0; i < count; i++)
+// a running optimization is cancelled and its results dropped
+void start_optimize(const int *handles, int count, double epsilon)
+{
+    if (optimize_job != NULL)
     {
-        x[i] = nifs3_get(intp->iX, u[i]);
-        y[i] = nifs3_get(intp->iY, u[i]);
+        cancel_optimize_job(optimize_job);
+        finish_optimize_job(optimize_job);
     }
 
-    douglas_prucker(x, y, count, epsilon, keep);
-    free(x);
-    free(y);
+    optimize_job = start_optimize_job(&curves, handles, count, epsilon);
+    schedule_optimize_poll();
+}
+
+void cancel_optimize()
+{
+    if (optimize_job == NULL)
+        return;
+
+    cancel_optimize_job(optimize_job);
+    finish_optimize_job(optimize_job);
+    optimize_job = NULL;
+}
 
-    int n = 0;
-    for (int i = 0; i < count; i++)
-        if (keep[i])
-            u[n++] = u[i];
+// NIFS3EDIT_STATS=1 reports the redraw rate and CPU usage on exit
+struct
+{
+    int redraws;
+    int start_ms;
+} stats;
 
-    set_nifs3_2d_interpolation_pts(i, u, n);
-    free(u);
+void print_stats()
+{
+    double wall = (glutGet(GLUT_ELAPSED_TIME) - stats.start_ms) / 1000.0;
+    double cpu = (double)clock() / CLOCKS_PER_SEC;
+    printf("%d redraws in %.1f s (%.2f/s), %.2f s CPU (%.2f%%)\n",
+           stats.redraws, wall, stats.redraws / wall, cpu, 100 * cpu / wall);
 }
 
 void keyboard(unsigned char c, int x_, int y_)
 {
-    double x = scene_data.xMin + (scene_data.xMax - scene_data.xMin) * ((double)x_ / scene_data.w);
-    double y = scene_data.yMin + (scene_data.yMax - scene_data.yMin) * ((double)(scene_data.h - y_) / scene_data.h);
+    double x, y;
+    screen_to_world(x_, y_, &x, &y);
 
     if (is_inputting_text(scene_data.mode))
     {
@@ -622,33 +498,37 @@ void keyboard(unsigned char c, int x_, int y_)
             switch (scene_data.mode)
             {
             case MODE_SAVE:
-                save_to_file(scene_data.text);
+                if (!save_to_file(&curves, scene_data.text))
+                    print_error("Failed to save file: %s", scene_data.text);
                 break;
             case MODE_LOAD:
-                if (!load_from_file(scene_data.text))
+                free_curve_caches();
+                if (!load_from_file(&curves, scene_data.text))
                     print_error("Failed to load file: %s", scene_data.text);
+                scene_data.edit_interpolator_i = -1;
                 break;
             case MODE_SET_U:
                 sscanf(scene_data.text, "%d", &i);
                 double *u = alloc_linspace(0, 1, i);
-                set_nifs3_2d_interpolation_pts(scene_data.edit_interpolator_i, u, i);
+                set_nifs3_2d_interpolation_pts(&curves, scene_data.edit_interpolator_i, u, i);
                 free(u);
                 break;
             case MODE_SELECT_EDIT:
                 sscanf(scene_data.text, "%d", &i);
-                if (i < 0 || i >= MAX_INTERPOLATORS || interp[i].iX == NULL)
+                if (!is_live_nifs3_2d(&curves, i))
                     i = -1;
                 scene_data.edit_interpolator_i = i;
                 break;
             case MODE_OPTIMIZE:
                 sscanf(scene_data.text, "%lf", &d);
-                optimize_nifs3_2d(scene_data.edit_interpolator_i, d);
+                if (is_live_nifs3_2d(&curves, scene_data.edit_interpolator_i))
+                    start_optimize(&scene_data.edit_interpolator_i, 1, d);
                 break;
             case MODE_OPTIMIZE_ALL:
                 sscanf(scene_data.text, "%lf", &d);
-                for (int i = 0; i < MAX_INTERPOLATORS; i++)
-                    if (interp[i].iX != NULL)
-                        optimize_nifs3_2d(i, d);
+                start_optimize(curves.live, curves.count, d);
+                break;
+            case MODE_NONE:
                 break;
             }
             scene_data.mode = MODE_NONE;
@@ -679,11 +559,19 @@ void keyboard(unsigned char c, int x_, int y_)
 
         switch (c)
         {
+        case 27: // esc
+            cancel_optimize();
+            break;
         case 'i':
             scene_data.showImage = !scene_data.showImage;
             break;
+        case 'L':
+            scene_data.lod = !scene_data.lod;
+            break;
         case 'c':
-            cleanup_nifs3_2d();
+            free_curve_caches();
+            cleanup_nifs3_2d(&curves);
+            scene_data.edit_interpolator_i = -1;
             break;
         case 's':
             scene_data.mode = MODE_SAVE;
@@ -708,11 +596,12 @@ void keyboard(unsigned char c, int x_, int y_)
                 print_error("No interpolator selected");
                 break;
             }
-            free_nifs3_2d(scene_data.edit_interpolator_i);
+            free_curve_cache(scene_data.edit_interpolator_i);
+            free_nifs3_2d(&curves, scene_data.edit_interpolator_i);
             scene_data.edit_interpolator_i = -1;
             break;
         case 'n':
-            scene_data.edit_interpolator_i = create_nifs3_2d(NULL, NULL, NULL, 0);
+            scene_data.edit_interpolator_i = create_nifs3_2d(&curves, NULL, NULL, NULL, 0);
             break;
         case 'q':
             exit(0);
@@ -723,7 +612,7 @@ void keyboard(unsigned char c, int x_, int y_)
                 print_error("No interpolator selected");
                 break;
             }
-            add_node_nifs3_2d(scene_data.edit_interpolator_i, x, y);
+            add_node_nifs3_2d(&curves, scene_data.edit_interpolator_i, x, y);
             break;
         case 'o':
             if (scene_data.edit_interpolator_i == -1)
@@ -744,7 +633,13 @@ void keyboard(unsigned char c, int x_, int y_)
 
 void motion(int x, int y)
 {
-    if (scene_data.dragging)
+    if (scene_data.dragging && scene_data.drag_interpolator_i != -1)
+    {
+        double wx, wy;
+        screen_to_world(x, y, &wx, &wy);
+        set_node_nifs3_2d(&curves, scene_data.drag_interpolator_i, scene_data.drag_node, wx, wy);
+    }
+    else if (scene_data.dragging)
     {
         double dx = x - scene_data.lastX;
         double dy = y - scene_data.lastY;
@@ -791,6 +686,56 @@ void drawText(const char *str, int x, int y)
     glMatrixMode(GL_MODELVIEW);
 }
 
+typedef struct
+{
+    int level; // LOD level
+    bool blink_on; // the selected curve is drawn white
+} draw_frame_t;
+
+// query_nifs3_2d callback drawing one visible curve
+bool draw_curve(void *ctx, int i)
+{
+    draw_frame_t *frame = ctx;
+    bool white = scene_data.edit_interpolator_i == i && frame->blink_on;
+
+    if (white)
+        glColor3f(1, 1, 1);
+    else
+        glColor3f(1, 0, 0);
+
+    curve_vbo_t *samples = curve_samples(i);
+    curve_vbo_t *line = scene_data.lod ? curve_lod(i, frame->level) : samples;
+
+    bind_curve_vbo(line);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glDrawArrays(GL_LINE_STRIP, 0, line->count);
+
+    if (white)
+        glColor3f(1, 1, 1);
+    else
+        glColor3f(0, 1, 0);
+
+    bind_curve_vbo(samples);
+    glPointSize(2);
+    glDrawArrays(GL_POINTS, 0, samples->count);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    if (white)
+        glColor3f(1, 1, 1);
+    else
+        glColor3f(0, 0, 1);
+
+    glPointSize(4);
+    glBegin(GL_POINTS);
+    for (int j = 0; j < curves.interp[i].iX->n; j++)
+        glVertex2d(curves.interp[i].iX->y[j], curves.interp[i].iY->y[j]);
+    glEnd();
+    glColor3f(1, 1, 1);
+
+    return true;
+}
+
 void display()
 {
     glClearColor(0, 0, 0, 0);
@@ -848,51 +793,32 @@ void display()
     drawText(scene_data.error, 0, 60);
     glColor3f(1, 1, 1);
 
+    if (optimize_job != NULL)
+    {
+        int total, finished = optimize_job_progress(optimize_job, &total);
+        sprintf(str, "Optimizing: %d/%d curves (Esc to cancel)", finished, total);
+        drawText(str, 0, 80);
+    }
+
     glLoadIdentity();
     glOrtho(scene_data.xMin, scene_data.xMax,
             scene_data.yMin, scene_data.yMax,
             -1, 1);
 
     int t = glutGet(GLUT_ELAPSED_TIME);
+    stats.redraws++;
 
-    for (int i = 0; i < MAX_INTERPOLATORS; i++)
-    {
-        if (interp[i].iX == NULL)
-            continue;
-
-        if (scene_data.edit_interpolator_i == i && t % 1000 < 500)
-            glColor3f(1, 1, 1);
-        else
-            glColor3f(1, 0, 0);
-
-        glBegin(GL_LINE_STRIP);
-        draw_nifs3_2d(i);
-        glEnd();
-
-        if (scene_data.edit_interpolator_i == i && t % 1000 < 500)
-            glColor3f(1, 1, 1);
-        else
-            glColor3f(0, 1, 0);
-
-        glPointSize(2);
-        glBegin(GL_POINTS);
-        draw_nifs3_2d(i);
-        glEnd();
-
-        if (scene_data.edit_interpolator_i == i && t % 1000 < 500)
-            glColor3f(1, 1, 1);
-        else
-            glColor3f(0, 0, 1);
+    int level = (int)floor(log2(scale));
 
-        glPointSize(4);
-        glBegin(GL_POINTS);
-        for (int j = 0; j < interp[i].iX->n; j++)
-            glVertex2d(interp[i].iX->y[j], interp[i].iY->y[j]);
-        glEnd();
-        glColor3f(1, 1, 1);
-    }
+    // curves entirely off screen are skipped before any evaluation; the
+    // margin covers the point sprites
+    double margin = 4 * scale;
+    draw_frame_t frame = {level, t % 1000 < 500};
+    query_nifs3_2d(&curves, scene_data.xMin - margin, scene_data.xMax + margin,
+                   scene_data.yMin - margin, scene_data.yMax + margin, draw_curve, &frame);
 
     glutSwapBuffers();
+    schedule_blink(t);
 }
 
 int main(int argc, char **argv)
@@ -900,7 +826,11 @@ int main(int argc, char **argv)
     glutInit(&argc, argv);
 
     init();
-    atexit(cleanup_nifs3_2d);
+    atexit(cleanup);
+
+    stats.start_ms = glutGet(GLUT_ELAPSED_TIME);
+    if (getenv("NIFS3EDIT_STATS") != NULL)
+        atexit(print_stats);
 
     // set up callback functions
     glutMouseFunc(mouse);
@@ -908,7 +838,6 @@ int main(int argc, char **argv)
     glutMotionFunc(motion);
     glutReshapeFunc(reshape);
     glutDisplayFunc(display);
-    glutTimerFunc(10, timer, 0);
     glutMainLoop();
 
     return 0;
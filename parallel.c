@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((b) < (a) ? (a) : (b))
+
+static int thread_count;
+
+int parallel_threads()
+{
+    if (thread_count == 0)
+    {
+        const char *env = getenv("NIFS3_THREADS");
+        thread_count = env != NULL ? atoi(env) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = max(thread_count, 1);
+    }
+    return thread_count;
+}
+
+void parallel_set_threads(int threads)
+{
+    thread_count = max(threads, 1);
+}
+
+// The indices still to run by one worker, [lo, hi). The owner takes them
+// from the front; a worker that ran out steals the back half of the first
+// non-empty range it finds, so uneven items even out without a shared
+// counter every item has to go through.
+typedef struct
+{
+    pthread_mutex_t lock;
+    int lo, hi;
+} range_t;
+
+// Workers are started on first use and kept: pool threads sleep on `wake`
+// between loops. Worker 0 is always the thread calling parallel_for.
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t wake, done;
+    int started; // pool threads, workers 1..started
+    range_t *ranges;
+    int ranges_cap;
+
+    // the current loop
+    unsigned generation;
+    int active; // workers taking part
+    int running; // pool threads still in it
+    void (*fn)(void *ctx, int i, int worker);
+    void *ctx;
+} pool = {.lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER, .done = PTHREAD_COND_INITIALIZER};
+
+// only one loop runs on the pool at a time
+static pthread_mutex_t loop_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool take(range_t *r, int *i)
+{
+    pthread_mutex_lock(&r->lock);
+    bool ok = r->lo < r->hi;
+    if (ok)
+        *i = r->lo++;
+    pthread_mutex_unlock(&r->lock);
+    return ok;
+}
+
+// moves the back half of another worker's range into the empty own one
+static bool steal(int worker)
+{
+    for (int k = 1; k < pool.active; k++)
+    {
+        range_t *victim = &pool.ranges[(worker + k) % pool.active];
+
+        pthread_mutex_lock(&victim->lock);
+        int lo = victim->lo + (victim->hi - victim->lo) / 2, hi = victim->hi;
+        victim->hi = lo;
+        pthread_mutex_unlock(&victim->lock);
+
+        if (lo < hi)
+        {
+            range_t *own = &pool.ranges[worker];
+            pthread_mutex_lock(&own->lock);
+            own->lo = lo;
+            own->hi = hi;
+            pthread_mutex_unlock(&own->lock);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void run_worker(int worker)
+{
+    do
+    {
+        for (int i; take(&pool.ranges[worker], &i);)
+            pool.fn(pool.ctx, i, worker);
+    } while (steal(worker));
+}
+
+static void *worker_main(void *arg)
+{
+    int worker = (int)(intptr_t)arg;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&pool.lock);
+    for (;;)
+    {
+        while (pool.generation == seen)
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        seen = pool.generation;
+
+        if (worker >= pool.active)
+            continue;
+
+        pthread_mutex_unlock(&pool.lock);
+        run_worker(worker);
+        pthread_mutex_lock(&pool.lock);
+
+        if (--pool.running == 0)
+            pthread_cond_signal(&pool.done);
+    }
+    return NULL;
+}
+
+// makes sure there are at least threads - 1 pool threads, returns the
+// number of workers available
+static int start_workers(int threads)
+{
+    if (threads > pool.ranges_cap)
+    {
+        pool.ranges = realloc(pool.ranges, sizeof(range_t) * threads);
+        for (int k = pool.ranges_cap; k < threads; k++)
+            pthread_mutex_init(&pool.ranges[k].lock, NULL);
+        pool.ranges_cap = threads;
+    }
+
+    while (pool.started < threads - 1)
+    {
+        pthread_t handle;
+        if (pthread_create(&handle, NULL, worker_main, (void *)(intptr_t)(pool.started + 1)) != 0)
+            break;
+        pthread_detach(handle);
+        pool.started++;
+    }
+    return pool.started + 1;
+}
+
+void parallel_for(int n, void (*fn)(void *ctx, int i, int worker), void *ctx)
+{
+    int threads = min(parallel_threads(), n);
+
+    // nested or concurrent loops run on the calling thread alone
+    if (threads <= 1 || pthread_mutex_trylock(&loop_lock) != 0)
+    {
+        for (int i = 0; i < n; i++)
+            fn(ctx, i, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    threads = min(threads, start_workers(threads));
+
+    // contiguous equal shares to start with
+    for (int k = 0; k < threads; k++)
+    {
+        pool.ranges[k].lo = (int)((long long)n * k / threads);
+        pool.ranges[k].hi = (int)((long long)n * (k + 1) / threads);
+    }
+
+    pool.fn = fn;
+    pool.ctx = ctx;
+    pool.active = threads;
+    pool.running = threads - 1;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    run_worker(0);
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.running > 0)
+        pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+
+    pthread_mutex_unlock(&loop_lock);
+}
@@ -0,0 +1,18 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// Number of worker threads parallel_for uses: the online CPU count unless
+// overridden by parallel_set_threads (or NIFS3_THREADS in the environment).
+int parallel_threads();
+void parallel_set_threads(int threads);
+
+// Runs fn(ctx, i, worker) for every i in [0, n) on up to parallel_threads()
+// threads, the calling thread included, and returns when all are done.
+// worker is in [0, parallel_threads()) and identifies the thread, so fn can
+// keep per-thread scratch buffers. Items are dealt out in contiguous shares
+// and idle workers steal from busy ones, so they may vary in cost. A loop
+// started while another one runs (from fn, or from a second thread) runs on
+// the calling thread alone, as worker 0.
+void parallel_for(int n, void (*fn)(void *ctx, int i, int worker), void *ctx);
+
+#endif
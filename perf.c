@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "nifs3.h"
+#include "parallel.h"
+#include "bench_util.h"
+
+// Absolute timings of the library for tracking regressions between
+// releases, one result per line: CSV (benchmark,param,value,unit) by
+// default, a JSON document with --json. Every value is the best of
+// MEASURE_REPEATS runs, each long enough to be timed reliably.
+
+///////////// Timing //////////////
+// keeps the compiler from dropping evaluations whose results are unused
+volatile double sink;
+
+///////////// Output //////////////
+bool json;
+int reported;
+
+void report(const char *benchmark, const char *param, double value, const char *unit)
+{
+    if (json)
+        printf("%s\n    {\"benchmark\": \"%s\", \"param\": \"%s\", \"value\": %.6g, \"unit\": \"%s\"}",
+               reported > 0 ? "," : "", benchmark, param, value, unit);
+    else
+        printf("%s,%s,%.6g,%s\n", benchmark, param, value, unit);
+    reported++;
+    fflush(stdout);
+}
+
+void report_n(const char *benchmark, long n, double value, const char *unit)
+{
+    char param[32];
+    snprintf(param, sizeof(param), "%ld", n);
+    report(benchmark, param, value, unit);
+}
+
+const char *isa_name(nifs3_isa_t isa)
+{
+    switch (isa)
+    {
+    case NIFS3_ISA_AVX2:
+        return "avx2";
+    case NIFS3_ISA_SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+///////////// Building splines //////////////
+typedef struct
+{
+    const double *t, *y;
+    int n;
+    bool coeffs;
+} init_t;
+
+void run_init(void *ctx)
+{
+    init_t *b = ctx;
+    nifs3_free(nifs3_init(b->t, b->y, b->n, b->coeffs));
+}
+
+// nifs3_init over n random values at evenly spaced knots, with and without
+// the power-basis coefficients
+void perf_init(int n)
+{
+    nifs3_t *fixture = random_spline(n, false);
+
+    init_t b = {fixture->x, fixture->y, n, false};
+    report_n("nifs3_init", n, measure(run_init, &b) / n * 1e9, "ns/knot");
+    b.coeffs = true;
+    report_n("nifs3_init_coeffs", n, measure(run_init, &b) / n * 1e9, "ns/knot");
+
+    nifs3_free(fixture);
+}
+
+///////////// Evaluation //////////////
+#define GET_QUERIES 4096
+
+typedef struct
+{
+    const nifs3_t *interp;
+    const double *q;
+} get_t;
+
+void run_get(void *ctx)
+{
+    get_t *b = ctx;
+    double acc = 0;
+    for (int j = 0; j < GET_QUERIES; j++)
+        acc += nifs3_get(b->interp, b->q[j]);
+    sink = acc;
+}
+
+// nifs3_get at GET_QUERIES points of a spline with n knots, in increasing
+// order and in random order
+void perf_get(int n)
+{
+    nifs3_t *interp = random_spline(n, true);
+
+    double *sorted = alloc_linspace(0, 1, GET_QUERIES);
+    double *random = random_values(GET_QUERIES);
+
+    get_t b = {interp, sorted};
+    report_n("nifs3_get_sorted", n, measure(run_get, &b) / GET_QUERIES * 1e9, "ns/eval");
+    b.q = random;
+    report_n("nifs3_get_random", n, measure(run_get, &b) / GET_QUERIES * 1e9, "ns/eval");
+
+    free(sorted);
+    free(random);
+    nifs3_free(interp);
+}
+
+///////////// Optimizing interpolation points //////////////
+typedef struct
+{
+    nifs3_pool_t *pool;
+    double epsilon;
+} optimize_t;
+
+void run_optimize(void *ctx)
+{
+    optimize_t *b = ctx;
+    for (int k = 0; k < b->pool->count; k++)
+        optimize_nifs3_2d(b->pool, b->pool->live[k], b->epsilon);
+}
+
+void run_optimize_all(void *ctx)
+{
+    optimize_t *b = ctx;
+    optimize_all_nifs3_2d(b->pool, b->epsilon);
+}
+
+// optimize_nifs3_2d over every curve of konkurs.data, one by one and with
+// optimize_all_nifs3_2d, and the interpolation points it leaves; the
+// splines do not change, so every run does the same work
+void perf_optimize(nifs3_pool_t *konkurs, double epsilon)
+{
+    char param[32];
+    snprintf(param, sizeof(param), "%g", epsilon);
+
+    optimize_t b = {konkurs, epsilon};
+    report("optimize_nifs3_2d", param, measure(run_optimize, &b) * 1e3, "ms");
+    report("optimize_all_nifs3_2d", param, measure(run_optimize_all, &b) * 1e3, "ms");
+
+    int points = 0;
+    for (int k = 0; k < konkurs->count; k++)
+        points += konkurs->interp[konkurs->live[k]].n;
+    report("optimize_nifs3_2d_points", param, points, "points");
+}
+
+///////////// Loading and saving //////////////
+typedef struct
+{
+    nifs3_pool_t *pool;
+    const char *path;
+} file_t;
+
+void run_save(void *ctx)
+{
+    file_t *b = ctx;
+    save_to_file(b->pool, b->path);
+}
+
+void run_load(void *ctx)
+{
+    file_t *b = ctx;
+    load_from_file(b->pool, b->path);
+}
+
+long file_size(const char *path)
+{
+    FILE *fh = fopen(path, "rb");
+    if (fh == NULL)
+        return 0;
+    fseek(fh, 0, SEEK_END);
+    long size = ftell(fh);
+    fclose(fh);
+    return size;
+}
+
+// save_to_file and load_from_file of side x side copies of konkurs.data,
+// as text and as binary; the files are in the page cache after the first
+// run, so this is parsing and writing speed, not disk speed
+void perf_io(const nifs3_pool_t *konkurs, int side)
+{
+    nifs3_pool_t pool = NIFS3_POOL_INIT;
+    tile_pool(konkurs, side, &pool);
+
+    const char *files[] = {"nifs3perf.data", "nifs3perf" BINARY_EXTENSION};
+    const char *names[][2] = {{"save_to_file_text", "load_from_file_text"},
+                              {"save_to_file_binary", "load_from_file_binary"}};
+
+    for (int f = 0; f < 2; f++)
+    {
+        char path[1024];
+        temp_path(files[f], path, sizeof(path));
+
+        file_t b = {&pool, path};
+        double save = measure(run_save, &b);
+        double mb = file_size(path) / (double)(1 << 20);
+        double load = measure(run_load, &b);
+
+        report_n(names[f][0], pool.count, mb / save, "MB/s");
+        report_n(names[f][1], pool.count, mb / load, "MB/s");
+        remove(path);
+    }
+
+    cleanup_nifs3_2d(&pool);
+}
+
+void usage()
+{
+    printf("usage: nifs3perf [--json] [--quick]\n"
+           "  --json   one JSON document instead of CSV\n"
+           "  --quick  smaller sizes, for a smoke test\n");
+}
+
+int main(int argc, char **argv)
+{
+    bool quick = false;
+    for (int a = 1; a < argc; a++)
+    {
+        if (strcmp(argv[a], "--json") == 0)
+            json = true;
+        else if (strcmp(argv[a], "--quick") == 0)
+            quick = true;
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    srand(1);
+    int max_knots = quick ? 10000 : 1000000;
+    int max_side = quick ? 8 : 64;
+
+    nifs3_pool_t konkurs = NIFS3_POOL_INIT;
+    if (!load_from_file(&konkurs, NIFS3_DATA_DIR "/konkurs.data"))
+        return 1;
+
+    if (json)
+        printf("{\n  \"threads\": %d,\n  \"isa\": \"%s\",\n  \"repeats\": %d,\n  \"results\": [",
+               parallel_threads(), isa_name(nifs3_isa_supported()), MEASURE_REPEATS);
+    else
+        printf("benchmark,param,value,unit\n");
+
+    for (int n = 10; n <= max_knots; n *= 10)
+        perf_init(n);
+    for (int n = 10; n <= max_knots; n *= 10)
+        perf_get(n);
+    for (double eps = 1; eps >= 1e-3; eps /= 10)
+        perf_optimize(&konkurs, eps);
+    for (int side = 2; side <= max_side; side *= 2)
+        perf_io(&konkurs, side);
+
+    if (json)
+        printf("\n  ]\n}\n");
+
+    cleanup_nifs3_2d(&konkurs);
+    return 0;
+}